@@ -3,20 +3,98 @@
 #include <limits.h>
 #include <time.h>
 #include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#define removeDirectory(path) _rmdir(path)
+#else
+#include <sys/mman.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#define removeDirectory(path) rmdir(path)
+#endif
 
 #define N 10
 #define MAX_FILES_PER_COMMIT 5
 #define MAX_FILE_CONTENT_SIZE 40000
 #define MAX_USERS 100
 #define MAX_USERNAME_LENGTH 50
+#define MAX_BRANCH_NAME_LENGTH 100
 #define MAX_PASSWORD_LENGTH 50
 #define MAX_FILE_COUNT 100
+#define COMMIT_INDEX_SIZE 1024
+#define SKETCH_SIZE 32 // MinHash slots per file sketch
+#define SKETCH_BANDS 8 // LSH bands, SKETCH_SIZE / SKETCH_BANDS rows each
+#define RENAME_THRESHOLD 50 // Minimum similarity (percent) for an inexact rename or copy
+#define MAX_BUCKET_CANDIDATES 64 // Cap on candidates taken from one LSH bucket
+#define BINARY_CHECK_SIZE 8192 // Bytes inspected when deciding whether content is binary
+#define BINARY_NON_TEXT_PERCENT 30
+#define DELTA_WINDOW 16 // Rolling hash window for binary deltas
+#define DELTA_HASH_BASE 257u
+#define DELTA_MAX_INSERT 127
+#define DELTA_MAX_COPY 0xFFFFFF
+#define DELTA_MAX_OFFSET 0xFFFFFFFFULL // Copy offsets are at most 4 bytes
+#define NUMSTAT_CACHE_SIZE 4096 // Line-count results cached per blob pair
+#define DIFFSTAT_BAR_WIDTH 50
+#define PATCH_CONTEXT_LINES 3
+#define MAX_WORKERS 16
+#define MERGE_BASE_CACHE_SIZE 1024 // LRU bound on cached merge bases
+#define MERGE_BASE_BUCKETS 2048
+#define REORDER_WINDOW 256
+#define MERGE_CLEAN 0
+#define MERGE_CONTENT_CONFLICT 1
+#define MERGE_DELETE_CONFLICT 2
+#define MERGE_REPLAYED 3 // Conflicts resolved from the rerere database
+#define REPLAY_CHERRY_PICK 0
+#define REPLAY_REVERT 1
+#define REPLAY_REBASE 2
+#define REPO_DIR ".svcs" // On-disk repository metadata
+#define RERERE_DATABASE REPO_DIR "/rerere.db"
+#define RERERE_BUCKETS 256
+#define PACKED_REFS REPO_DIR "/packed-refs"
+#define REFTABLE_MAGIC "SVRT"
+#define REFTABLE_VERSION 1
+#define REFTABLE_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16 // Every 16th record stores its full name
+#define REF_BRANCH 0 // Packed record types
+#define REF_TAG 1
+#define REF_ANNOTATED_TAG 2 // Target is the tag object, followed by the peeled commit ID
+#define TAG_PREFIX "tags/" // Tags share the ref store under this namespace
+#define REFS_DIR REPO_DIR "/refs" // Loose refs: one file per branch holding its commit ID
+#define REF_PATH_LENGTH (MAX_BRANCH_NAME_LENGTH + 32)
+#define REF_TX_OK 0
+#define REF_TX_CONFLICT 1 // A branch was not at its expected old tip
+#define REF_TX_LOCKED 2 // Another writer holds a branch's lock file
+#define REF_TX_INVALID 3
+#define REFLOGS_DIR REPO_DIR "/logs" // One append-only reflog per branch
+#define REFLOG_RECORD_SIZE 64
+#define REFLOG_MESSAGE_LENGTH 48
+#define REFLOG_NO_COMMIT INT_MIN
+#define REFLOG_EXPIRE_DAYS 90 // Default age limit for reflog expiry
+#define UNDO_REFLOG_PREFIX "undo: " // Reflog message of a move made by undoMove
+#define SPARSE_CHECKOUT "sparse-checkout"
+#define WORKTREES_DIR REPO_DIR "/worktrees"
+#define STAT_CACHE "index" // Working-tree stat cache, one per worktree
+#define WORKING_PATH_LENGTH (REF_PATH_LENGTH + 64)
+#define FLAG_PARENT1 1 // Merge-base walk paint: reachable from the first tip
+#define FLAG_PARENT2 2
+#define FLAG_STALE 4 // Below a common ancestor, cannot be a best base
+#define FLAG_RESULT 8 // Finished-but-unemitted results a worker pool may hold
+#define FLAG_COUNTED 16 // Ahead/behind walk: node already counted
+#define AHEAD_BEHIND_STEP_LIMIT 256 // Longest tip move updated incrementally
 
 int nextFileID = 1; // Global variable to track the next available file ID
+int nextVirtualID = -2; // Virtual merge bases count down from -2, the root commit is -1
 
 typedef struct File {
     int fileID;
     char content[MAX_FILE_CONTENT_SIZE];
+    size_t size; // Content length in bytes, content may hold NULs
+    unsigned long long contentHash; // Hash of the content, used as the object identity
     struct File* next;
 } File;
 
@@ -32,20 +110,265 @@ typedef struct commit {
     char originalFileName[50];
 } commit;
 
+typedef struct treeEntry {
+    char path[50];
+    int fileID;
+} treeEntry;
+
+// Path -> file ID view of a commit, entries kept sorted by path
+typedef struct snapshot {
+    int count;
+    int capacity;
+    treeEntry* entries;
+} snapshot;
+
 typedef struct graphNode {
     struct commit* commit;
     struct graphNode* parent; // Parent in the directed acyclic graph
     struct graphNode* nextParent; // Next parent in the linked list of parents
+    struct graphNode* mergeParent; // Second parent, set only on merge commits
+    int generation; // 1 + highest parent generation, 0 until computed
+    struct snapshot* tree; // Cached snapshot of this commit, built lazily
+    int references; // Virtual merge bases only: cache entries and virtual children holding it
 } graphNode;
 
+typedef struct nodeSet {
+    int count;
+    int capacity;
+    graphNode** slots; // Open addressing, capacity is a power of two
+    int* values; // Per-node value, used for flags during graph walks
+} nodeSet;
+
+// Max-heap of commits ordered by generation, used by the merge-base walk
+typedef struct nodeHeap {
+    graphNode** items;
+    char* active; // Whether the entry was queued with a non-stale paint
+    int count;
+    int capacity;
+    int activeCount;
+} nodeHeap;
+
+typedef struct commitIndexEntry {
+    graphNode* node;
+    struct commitIndexEntry* next;
+} commitIndexEntry;
+
+typedef struct mergeBaseEntry {
+    int commitA; // Smaller commit ID of the pair
+    int commitB;
+    graphNode* base; // NULL when the commits share no ancestor
+    struct mergeBaseEntry* hashNext;
+    struct mergeBaseEntry* newer; // LRU list neighbours
+    struct mergeBaseEntry* older;
+} mergeBaseEntry;
+
+typedef struct mergeBaseCache {
+    mergeBaseEntry* buckets[MERGE_BASE_BUCKETS];
+    mergeBaseEntry* newest;
+    mergeBaseEntry* oldest;
+    int count;
+    int hits;
+    int misses;
+} mergeBaseCache;
+
+typedef struct statEntry {
+    char path[50];
+    int fileID; // Object last written to (or verified at) this path
+    long long size;
+    long long mtime; // -1 when the entry must be verified by content
+} statEntry;
+
+typedef struct statCache {
+    int loaded;
+    int dirty;
+    int count;
+    int capacity;
+    statEntry* entries; // Sorted by path
+} statCache;
+
+typedef struct sparseDirectory {
+    char* path; // NULL: empty slot
+    int length;
+    int recursive; // Listed directory: everything below it is included, not just its own files
+    unsigned long long hash;
+} sparseDirectory;
+
+// Cone-mode sparse checkout: the listed directories are included recursively, along with
+// the files directly inside their ancestors and at the top level
+typedef struct sparseCone {
+    int loaded;
+    int enabled;
+    int count;
+    int slotCount; // Power of two, open addressing
+    sparseDirectory* slots;
+} sparseCone;
+
+// A merge stopped on conflicts; the next commit concludes it as a two-parent commit
+typedef struct pendingMerge {
+    graphNode* ours; // Branch tip the merge was made on
+    graphNode* theirs;
+    snapshot* tree; // What the merge wrote, conflicted paths with their markers
+    snapshot* conflicts; // Conflicted path -> file ID written with markers
+} pendingMerge;
+
+// One checkout of a repository: its own directory, current branch, stat cache and sparse
+// patterns. All worktrees share the repository's objects and refs.
+typedef struct worktree {
+    char name[MAX_BRANCH_NAME_LENGTH]; // Empty for the main worktree
+    char root[REF_PATH_LENGTH]; // Prefix of its working files: empty, or a directory ending in '/'
+    int currentBranchIndex; // Index of the current branch in the branch array
+    statCache workingStats;
+    sparseCone sparse;
+    snapshot* pendingResolutions; // Conflicted path -> file ID written with markers
+    pendingMerge* merge; // NULL unless a conflicted merge awaits its commit
+    struct worktree* next;
+} worktree;
+
+typedef struct aheadBehindEntry {
+    int valid;
+    struct graphNode* tip;
+    struct graphNode* base;
+    int ahead;
+    int behind;
+} aheadBehindEntry;
+
+typedef struct refTrieNode {
+    int refIndex; // Leaf: index into branches and nodes; -1 for internal nodes
+    size_t byte; // Internal: first byte where the two subtrees differ
+    unsigned char mask; // Internal: every bit set except the one that differs
+    struct refTrieNode* child[2];
+} refTrieNode;
+
 typedef struct repository {
-    struct graphNode* nodes[N];
+    struct graphNode** nodes; // Branch tips; a branch is just a name and this pointer
     File* fileHash[N]; // Array of linked lists for file storage
-    int currentBranchIndex; // Index of the current branch in the branch array
     int branchCount; // Total number of branches
-    char* branches[N]; // Array to store branch names
+    int branchCapacity;
+    char** branches; // Array to store branch names
+    int* refObjects; // Annotated tags: file ID of the tag object, otherwise -1
+    aheadBehindEntry* aheadBehind; // Per branch: last ahead/behind count and the tips it was for
+    refTrieNode* refRoot; // Name -> branch index
+    pthread_mutex_t refLock; // Held while a ref transaction checks and applies updates
+    commitIndexEntry* commitIndex[COMMIT_INDEX_SIZE]; // Commit ID -> node lookup
+    mergeBaseCache* mergeBases;
+    struct worktree* worktree; // The checkout commands operate on
+    struct worktree* worktrees; // Every checkout sharing these objects and refs, main first
 } repository;
 
+typedef void (*refVisitor)(repository* repo, int refIndex, void* context);
+
+typedef struct refUpdate {
+    char name[MAX_BRANCH_NAME_LENGTH];
+    graphNode* expectedOld; // NULL: the branch must not exist
+    graphNode* newTip; // NULL: delete the branch
+    int object; // Annotated tag object stored with the ref, or -1
+    int locked; // This update holds the branch's lock file
+} refUpdate;
+
+typedef struct refTransaction {
+    int count;
+    int capacity;
+    refUpdate* updates;
+    char message[REFLOG_MESSAGE_LENGTH]; // Recorded in the reflog of every updated branch
+} refTransaction;
+
+typedef struct reflogRecord {
+    int oldID; // REFLOG_NO_COMMIT when the branch was created
+    int newID; // REFLOG_NO_COMMIT when the branch was deleted
+    time_t time;
+    char message[REFLOG_MESSAGE_LENGTH];
+} reflogRecord;
+
+// A packed ref table opened for reading, mapped into memory where possible
+typedef struct refTable {
+    const unsigned char* data;
+    size_t size;
+    int mapped;
+    unsigned int blockSize;
+    unsigned int blockCount;
+    unsigned int refCount;
+    unsigned int indexOffset;
+} refTable;
+
+typedef struct refCursor {
+    const refTable* table;
+    unsigned int block;
+    size_t offset; // Of the next record within the block
+    int valid;
+    char name[MAX_BRANCH_NAME_LENGTH];
+    int type;
+    int target;
+    int peeled; // Commit ID a tag finally points to; same as target for other refs
+} refCursor;
+
+typedef struct diffEntry {
+    char status; // 'A'dded, 'D'eleted, 'M'odified, 'R'enamed or 'C'opied
+    int score; // Similarity percentage for renames and copies
+    char oldPath[50];
+    char newPath[50];
+    int oldFileID;
+    int newFileID;
+} diffEntry;
+
+typedef struct deltaBuffer {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+    int copyOps;
+    int insertOps;
+} deltaBuffer;
+
+typedef struct lineTable {
+    int count;
+    unsigned long long* hashes;
+    const char** starts; // Only filled when spans are requested
+    int* lengths;
+} lineTable;
+
+typedef struct textBuffer {
+    char* data;
+    size_t size;
+    size_t capacity;
+} textBuffer;
+
+typedef void (*parallelTask)(void* context, int index);
+
+typedef struct mergeReportEntry {
+    char path[50];
+    int status; // MERGE_CLEAN, MERGE_REPLAYED, MERGE_CONTENT_CONFLICT or MERGE_DELETE_CONFLICT
+} mergeReportEntry;
+
+// Paths that needed a content merge, and which of them conflicted
+typedef struct mergeReport {
+    int conflicts;
+    int count;
+    int capacity;
+    mergeReportEntry* entries;
+} mergeReport;
+
+typedef struct rerereEntry {
+    unsigned long long key; // conflictKey of the two sides
+    char* resolution;
+    size_t length;
+    struct rerereEntry* next;
+} rerereEntry;
+
+typedef struct numstatCacheEntry {
+    int valid;
+    unsigned long long oldHash;
+    unsigned long long newHash;
+    const File* oldFile; // Files the counts were taken from, to confirm a hash hit
+    const File* newFile;
+    int added;
+    int removed;
+} numstatCacheEntry;
+
+typedef struct diffList {
+    int count;
+    int capacity;
+    diffEntry* entries;
+} diffList;
+
 typedef struct stackNode {
     struct graphNode* node;
     struct stackNode* next;
@@ -73,6 +396,10 @@ graphNode* createGraphNode(commit* commit) {
     newNode->commit = commit;
     newNode->parent = NULL;
     newNode->nextParent = NULL;
+    newNode->mergeParent = NULL;
+    newNode->generation = 0;
+    newNode->tree = NULL;
+    newNode->references = 0;
     return newNode;
 }
 
@@ -85,6 +412,8 @@ graphNode* createRepoNode(const char* repoName) {
 
     snprintf(newCommit->message, sizeof(newCommit->message), "Initial commit for repository '%s'", repoName);
     newCommit->fileID = -1;
+    newCommit->fileCount = 0;
+    newCommit->originalFileName[0] = '\0';
     snprintf(newCommit->author, sizeof(newCommit->author), "System");
     
     time_t t = time(NULL);
@@ -95,394 +424,5351 @@ graphNode* createRepoNode(const char* repoName) {
     return newNode;
 }
 
-repository* initRepository(const char* repoName) {
-    repository* newRepo = (repository*)malloc(sizeof(repository));
-    if (newRepo == NULL) {
-        printf("Error: Memory allocation failed.\n");
-        return NULL;
-    }
+int commitIndexSlot(int commitID) {
+    unsigned int key = (unsigned int)commitID;
+    return (int)((key * 2654435761u) % COMMIT_INDEX_SIZE);
+}
 
-    for (int i = 0; i < N; i++) {
-        newRepo->nodes[i] = NULL;
-        newRepo->fileHash[i] = NULL;
-        newRepo->branches[i] = NULL;
+void registerCommit(repository* repo, graphNode* node) {
+    commitIndexEntry* entry = (commitIndexEntry*)malloc(sizeof(commitIndexEntry));
+    int slot = commitIndexSlot(node->commit->fileID);
+    entry->node = node;
+    entry->next = repo->commitIndex[slot];
+    repo->commitIndex[slot] = entry;
+}
+
+graphNode* findCommit(repository* repo, int commitID) {
+    commitIndexEntry* entry = repo->commitIndex[commitIndexSlot(commitID)];
+    while (entry != NULL) {
+        if (entry->node->commit->fileID == commitID) {
+            return entry->node;
+        }
+        entry = entry->next;
     }
-    newRepo->currentBranchIndex = -1;
-    newRepo->branchCount = 0;
+    return NULL;
+}
 
-    const char* defaultBranchName = "main";
-    newRepo->branches[0] = strdup(defaultBranchName);
-    newRepo->branchCount++;
+//-----------------REF STORE--------------------------------------------
 
-    graphNode* repoNode = createRepoNode(repoName);
-    newRepo->nodes[0] = repoNode;
+// Crit-bit trie over branch names: internal nodes test one bit of one byte, leaves
+// hold the index of the branch in branches/nodes. Lookups cost one pass over the name
+// and an in-order walk visits names sorted, so a prefix is a single subtree.
+int refDirection(const refTrieNode* node, const char* name, size_t length) {
+    unsigned char c = node->byte < length ? (unsigned char)name[node->byte] : 0;
+    return (1 + (node->mask | c)) >> 8;
+}
 
-    return newRepo;
+refTrieNode* closestRef(refTrieNode* node, const char* name, size_t length) {
+    while (node != NULL && node->refIndex < 0) {
+        node = node->child[refDirection(node, name, length)];
+    }
+    return node;
 }
 
-void addParent(graphNode* child, graphNode* parent) {
-    parent->nextParent = child->parent;
-    child->parent = parent;
+int findBranch(repository* repo, const char* branchName) {
+    refTrieNode* leaf = closestRef(repo->refRoot, branchName, strlen(branchName));
+    if (leaf != NULL && strcmp(repo->branches[leaf->refIndex], branchName) == 0) {
+        return leaf->refIndex;
+    }
+    return -1;
 }
 
-void printFileChanges(const char* originalFileName, const char* updatedFileName) {
-    FILE* originalFile = fopen(originalFileName, "r");
-    FILE* updatedFile = fopen(updatedFileName, "r");
+// Adds a leaf for branches[refIndex]; the name must not be in the trie yet
+void insertRef(repository* repo, int refIndex) {
+    const char* name = repo->branches[refIndex];
+    size_t length = strlen(name);
+    refTrieNode* leaf = (refTrieNode*)calloc(1, sizeof(refTrieNode));
+    leaf->refIndex = refIndex;
+    if (repo->refRoot == NULL) {
+        repo->refRoot = leaf;
+        return;
+    }
 
-    if (originalFile == NULL || updatedFile == NULL) {
-        printf("Error: Unable to open file.\n");
+    const char* closest = repo->branches[closestRef(repo->refRoot, name, length)->refIndex];
+    size_t byte = 0;
+    while (name[byte] != '\0' && name[byte] == closest[byte]) {
+        byte++;
+    }
+    unsigned int differing = (unsigned char)name[byte] ^ (unsigned char)closest[byte];
+    while (differing & (differing - 1)) {
+        differing &= differing - 1; // Keep the highest differing bit
+    }
+    unsigned char mask = (unsigned char)(~differing);
+    int direction = (1 + (mask | (unsigned char)closest[byte])) >> 8;
+
+    refTrieNode* internal = (refTrieNode*)malloc(sizeof(refTrieNode));
+    internal->refIndex = -1;
+    internal->byte = byte;
+    internal->mask = mask;
+    internal->child[1 - direction] = leaf;
+
+    refTrieNode** link = &repo->refRoot;
+    while ((*link)->refIndex < 0) {
+        refTrieNode* node = *link;
+        if (node->byte > byte || (node->byte == byte && node->mask > mask)) {
+            break;
+        }
+        link = &node->child[refDirection(node, name, length)];
+    }
+    internal->child[direction] = *link;
+    *link = internal;
+}
+
+void walkRefs(repository* repo, refTrieNode* node, refVisitor visit, void* context) {
+    if (node->refIndex >= 0) {
+        visit(repo, node->refIndex, context);
         return;
     }
+    walkRefs(repo, node->child[0], visit, context);
+    walkRefs(repo, node->child[1], visit, context);
+}
 
-    printf("Changes between %s and %s:\n", originalFileName, updatedFileName);
+// Calls visit for every branch whose name starts with prefix, in name order
+void forEachRef(repository* repo, const char* prefix, refVisitor visit, void* context) {
+    size_t length = strlen(prefix);
+    refTrieNode* top = repo->refRoot;
+    while (top != NULL && top->refIndex < 0 && top->byte < length) {
+        top = top->child[refDirection(top, prefix, length)];
+    }
+    if (top == NULL) {
+        return;
+    }
+    refTrieNode* sample = closestRef(top, prefix, length);
+    if (strncmp(repo->branches[sample->refIndex], prefix, length) == 0) {
+        walkRefs(repo, top, visit, context);
+    }
+}
 
-    char originalLine[MAX_FILE_CONTENT_SIZE];
-    char updatedLine[MAX_FILE_CONTENT_SIZE];
-    int lineNum = 1;
-    int differencesFound = 0;
+void countRef(repository* repo, int refIndex, void* context) {
+    (void)repo;
+    (void)refIndex;
+    (*(int*)context)++;
+}
 
-    while (fgets(originalLine, sizeof(originalLine), originalFile) != NULL &&
-           fgets(updatedLine, sizeof(updatedLine), updatedFile) != NULL) {
-        if (strcmp(originalLine, updatedLine) != 0) {
-            printf("Difference found in line %d:\n", lineNum);
-            printf("Original: %s", originalLine);
-            printf("Updated: %s", updatedLine);
-            printf("\n");
-            differencesFound = 1;
+// Branch names are slash-separated paths ("release/2.3"): no empty or dot-led
+// components, and a name cannot also be a directory of other names
+int hasInvalidRefCharacter(const char* name) {
+    for (const char* c = name; *c != '\0'; c++) {
+        if (*c <= ' ' || *c == '~' || *c == '^' || *c == ':' || *c == '\\' || *c == '*' || *c == '?' || *c == '[') {
+            return 1;
         }
-        lineNum++;
     }
+    return 0;
+}
 
-    while (fgets(originalLine, sizeof(originalLine), originalFile) != NULL) {
-        printf("Difference found in line %d:\n", lineNum);
-        printf("Original: %s", originalLine);
-        printf("Updated: (End of file)\n");
-        printf("\n");
-        differencesFound = 1;
-        lineNum++;
+int validBranchName(repository* repo, const char* branchName) {
+    size_t length = strlen(branchName);
+    if (length == 0 || length >= MAX_BRANCH_NAME_LENGTH || branchName[length - 1] == '/') {
+        return 0;
+    }
+    const char* component = branchName;
+    while (1) {
+        if (*component == '/' || *component == '.' || *component == '\0') {
+            return 0;
+        }
+        const char* slash = strchr(component, '/');
+        if (slash == NULL) {
+            break;
+        }
+        char parent[MAX_BRANCH_NAME_LENGTH];
+        snprintf(parent, sizeof(parent), "%.*s", (int)(slash - branchName), branchName);
+        if (findBranch(repo, parent) != -1) {
+            return 0;
+        }
+        component = slash + 1;
+    }
+    if (hasInvalidRefCharacter(branchName)) {
+        return 0;
     }
 
-    while (fgets(updatedLine, sizeof(updatedLine), updatedFile) != NULL) {
-        printf("Difference found in line %d:\n", lineNum);
-        printf("Original: (End of file)\n");
-        printf("Updated: %s", updatedLine);
-        printf("\n");
-        differencesFound = 1;
-        lineNum++;
+    char directory[MAX_BRANCH_NAME_LENGTH + 1];
+    snprintf(directory, sizeof(directory), "%s/", branchName);
+    int children = 0;
+    forEachRef(repo, directory, countRef, &children);
+    return children == 0;
+}
+
+int isTagRef(const char* name) {
+    return strncmp(name, TAG_PREFIX, strlen(TAG_PREFIX)) == 0;
+}
+
+// Appends a branch to the store; the name must be valid and unused
+int addBranch(repository* repo, const char* branchName, graphNode* tip) {
+    if (repo->branchCount == repo->branchCapacity) {
+        repo->branchCapacity *= 2;
+        repo->nodes = (graphNode**)realloc(repo->nodes, repo->branchCapacity * sizeof(graphNode*));
+        repo->branches = (char**)realloc(repo->branches, repo->branchCapacity * sizeof(char*));
+        repo->refObjects = (int*)realloc(repo->refObjects, repo->branchCapacity * sizeof(int));
+        repo->aheadBehind = (aheadBehindEntry*)realloc(repo->aheadBehind, repo->branchCapacity * sizeof(aheadBehindEntry));
     }
+    int branchIndex = repo->branchCount++;
+    repo->branches[branchIndex] = strdup(branchName);
+    repo->nodes[branchIndex] = tip;
+    repo->refObjects[branchIndex] = -1;
+    repo->aheadBehind[branchIndex].valid = 0;
+    insertRef(repo, branchIndex);
+    return branchIndex;
+}
 
-    if (!differencesFound) {
-        printf("No differences found between %s and %s.\n", originalFileName, updatedFileName);
+int ensureRepoDirectory() {
+    makeDirectory(REPO_DIR);
+    FILE* probe = fopen(REPO_DIR "/.probe", "w");
+    if (probe == NULL) {
+        return 0;
     }
+    fclose(probe);
+    remove(REPO_DIR "/.probe");
+    return 1;
+}
 
-    fclose(originalFile);
-    fclose(updatedFile);
+// rename() that also replaces an existing target on Windows
+int replaceFile(const char* from, const char* to) {
+#ifdef _WIN32
+    remove(to);
+#endif
+    return rename(from, to) == 0;
 }
 
-graphNode* commit_file(const char* fileName, const char* message, int id, const char* author, repository* repo) {
-    FILE* file = fopen(fileName, "r");
-    if (file == NULL) {
-        printf("Error: Unable to open file.\n");
-        return NULL;
+// Creates every directory leading up to the last component of path
+void makeParentDirectories(const char* path) {
+    char directory[REF_PATH_LENGTH];
+    for (const char* slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        snprintf(directory, sizeof(directory), "%.*s", (int)(slash - path), path);
+        makeDirectory(directory);
     }
+}
 
-    File* newFile = (File*)malloc(sizeof(File));
-    if (newFile == NULL) {
-        printf("Error: Memory allocation failed.\n");
-        fclose(file);
-        return NULL;
+// The worktree whose current branch is branchIndex, if any
+worktree* worktreeOnBranch(repository* repo, int branchIndex) {
+    for (worktree* tree = repo->worktrees; tree != NULL; tree = tree->next) {
+        if (tree->currentBranchIndex == branchIndex) {
+            return tree;
+        }
     }
+    return NULL;
+}
 
-    newFile->fileID = id;
-    newFile->next = NULL;
-    newFile->content[0] = '\0';
+const char* worktreeName(const repository* repo, const worktree* tree) {
+    return tree == repo->worktrees ? "main" : tree->name;
+}
 
-    char line[MAX_FILE_CONTENT_SIZE];
-    size_t bytesRead;
-    while ((bytesRead = fread(line, 1, sizeof(line), file)) > 0) {
-        strncat(newFile->content, line, bytesRead);
+// Where the active worktree keeps the working file at path (relative to its root)
+const char* workingPath(const repository* repo, const char* path, char* buffer) {
+    if (repo->worktree->root[0] == '\0') {
+        return path;
     }
+    snprintf(buffer, WORKING_PATH_LENGTH, "%s%s", repo->worktree->root, path);
+    return buffer;
+}
 
-    int index = id % N;
-    if (repo->fileHash[index] == NULL) {
-        repo->fileHash[index] = newFile;
+// Where the active worktree keeps its own metadata file: the main worktree in the
+// repository directory, linked worktrees each in a directory below it
+const char* worktreeFile(const repository* repo, const char* file, const char* suffix, char* buffer) {
+    if (repo->worktree->name[0] == '\0') {
+        snprintf(buffer, WORKING_PATH_LENGTH, "%s/%s%s", REPO_DIR, file, suffix);
     } else {
-        newFile->next = repo->fileHash[index];
-        repo->fileHash[index] = newFile;
+        snprintf(buffer, WORKING_PATH_LENGTH, "%s/%s/%s%s", WORKTREES_DIR, repo->worktree->name, file, suffix);
     }
+    return buffer;
+}
 
-    commit* newCommit = (commit*)malloc(sizeof(commit));
-    if (newCommit == NULL) {
-        printf("Error: Memory allocation failed.\n");
-        fclose(file);
+// Removes the directories above path that are left empty, deepest first, stopping at
+// the first keep characters (the worktree root)
+void removeEmptyParents(const char* path, int keep) {
+    char directory[WORKING_PATH_LENGTH];
+    snprintf(directory, sizeof(directory), "%s", path);
+    for (char* slash = strrchr(directory, '/'); slash != NULL && slash - directory >= keep; slash = strrchr(directory, '/')) {
+        *slash = '\0';
+        if (removeDirectory(directory) != 0) {
+            break;
+        }
+    }
+}
+
+// Unlinks a branch from the trie and fills its slot with the last branch
+void removeBranch(repository* repo, int refIndex) {
+    const char* name = repo->branches[refIndex];
+    size_t length = strlen(name);
+    refTrieNode** link = &repo->refRoot;
+    refTrieNode** parentLink = NULL;
+    int direction = 0;
+    while ((*link)->refIndex < 0) {
+        parentLink = link;
+        direction = refDirection(*link, name, length);
+        link = &(*link)->child[direction];
+    }
+    free(*link);
+    if (parentLink == NULL) {
+        repo->refRoot = NULL;
+    } else {
+        refTrieNode* parent = *parentLink;
+        *parentLink = parent->child[1 - direction];
+        free(parent);
+    }
+
+    free(repo->branches[refIndex]);
+    int last = --repo->branchCount;
+    if (refIndex != last) {
+        repo->branches[refIndex] = repo->branches[last];
+        repo->nodes[refIndex] = repo->nodes[last];
+        repo->refObjects[refIndex] = repo->refObjects[last];
+        repo->aheadBehind[refIndex] = repo->aheadBehind[last];
+        const char* moved = repo->branches[refIndex];
+        closestRef(repo->refRoot, moved, strlen(moved))->refIndex = refIndex;
+        for (worktree* tree = repo->worktrees; tree != NULL; tree = tree->next) {
+            if (tree->currentBranchIndex == last) {
+                tree->currentBranchIndex = refIndex;
+            }
+        }
+    }
+}
+
+void writeU32(unsigned char* bytes, unsigned int value) {
+    bytes[0] = value & 0xff;
+    bytes[1] = (value >> 8) & 0xff;
+    bytes[2] = (value >> 16) & 0xff;
+    bytes[3] = (value >> 24) & 0xff;
+}
+
+unsigned int readU32(const unsigned char* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+// Reflog records are REFLOG_RECORD_SIZE bytes: u32 old commit ID, u32 new commit ID,
+// u64 time and a NUL-padded message, so the k-th newest entry is one seek from the end
+void encodeReflogRecord(const reflogRecord* record, unsigned char* bytes) {
+    memset(bytes, 0, REFLOG_RECORD_SIZE);
+    writeU32(bytes, (unsigned int)record->oldID);
+    writeU32(bytes + 4, (unsigned int)record->newID);
+    unsigned long long when = (unsigned long long)record->time;
+    writeU32(bytes + 8, (unsigned int)(when & 0xffffffffu));
+    writeU32(bytes + 12, (unsigned int)(when >> 32));
+    memcpy(bytes + 16, record->message, strnlen(record->message, REFLOG_MESSAGE_LENGTH - 1));
+}
+
+void decodeReflogRecord(const unsigned char* bytes, reflogRecord* record) {
+    record->oldID = (int)readU32(bytes);
+    record->newID = (int)readU32(bytes + 4);
+    record->time = (time_t)(readU32(bytes + 8) | ((unsigned long long)readU32(bytes + 12) << 32));
+    memcpy(record->message, bytes + 16, REFLOG_MESSAGE_LENGTH);
+    record->message[REFLOG_MESSAGE_LENGTH - 1] = '\0';
+}
+
+void reflogPath(const char* name, const char* suffix, char* path) {
+    snprintf(path, REF_PATH_LENGTH, "%s/%s%s", REFLOGS_DIR, name, suffix);
+}
+
+void appendReflog(const char* name, int oldID, int newID, const char* message) {
+    reflogRecord record;
+    record.oldID = oldID;
+    record.newID = newID;
+    record.time = time(NULL);
+    snprintf(record.message, sizeof(record.message), "%s", message);
+    unsigned char bytes[REFLOG_RECORD_SIZE];
+    encodeReflogRecord(&record, bytes);
+
+    char path[REF_PATH_LENGTH];
+    reflogPath(name, "", path);
+    makeParentDirectories(path);
+    int descriptor = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (descriptor < 0) {
+        return;
+    }
+    if (write(descriptor, bytes, REFLOG_RECORD_SIZE) != REFLOG_RECORD_SIZE) {
+        printf("Error: Failed to write reflog for '%s'.\n", name);
+    }
+    close(descriptor);
+}
+
+FILE* openReflog(const char* name, long* count) {
+    char path[REF_PATH_LENGTH];
+    reflogPath(name, "", path);
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
         return NULL;
     }
+    fseek(file, 0, SEEK_END);
+    *count = ftell(file) / REFLOG_RECORD_SIZE;
+    return file;
+}
 
-    snprintf(newCommit->message, sizeof(newCommit->message), "%s", message);
-    newCommit->fileID = newFile->fileID;
-    snprintf(newCommit->author, sizeof(newCommit->author), "%s", author);
-    snprintf(newCommit->originalFileName, sizeof(newCommit->originalFileName), "%s", fileName);
+int readReflogRecord(FILE* file, long index, reflogRecord* record) {
+    unsigned char bytes[REFLOG_RECORD_SIZE];
+    if (fseek(file, index * REFLOG_RECORD_SIZE, SEEK_SET) != 0 || fread(bytes, 1, REFLOG_RECORD_SIZE, file) != REFLOG_RECORD_SIZE) {
+        return 0;
+    }
+    decodeReflogRecord(bytes, record);
+    return 1;
+}
 
-    time_t t = time(NULL);
-    struct tm* tm_info = localtime(&t);
-    strftime(newCommit->timestamp, sizeof(newCommit->timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+// The entry `back` moves before the newest one (0 is the newest)
+int readReflogEntry(const char* name, long back, reflogRecord* record) {
+    long count;
+    FILE* file = openReflog(name, &count);
+    if (file == NULL) {
+        return 0;
+    }
+    int found = back >= 0 && back < count && readReflogRecord(file, count - 1 - back, record);
+    fclose(file);
+    return found;
+}
 
+// Index of the first entry newer than when; entries are appended in time order
+long firstReflogEntryAfter(FILE* file, long count, time_t when) {
+    long low = 0;
+    long high = count;
+    reflogRecord record;
+    while (low < high) {
+        long middle = (low + high) / 2;
+        if (readReflogRecord(file, middle, &record) && record.time <= when) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// The move that set the branch as it was at time when
+int readReflogAt(const char* name, time_t when, reflogRecord* record) {
+    long count;
+    FILE* file = openReflog(name, &count);
+    if (file == NULL) {
+        return 0;
+    }
+    long index = firstReflogEntryAfter(file, count, when) - 1;
+    int found = index >= 0 && readReflogRecord(file, index, record);
     fclose(file);
+    return found;
+}
 
-    graphNode* newNode = createGraphNode(newCommit);
+// Drops entries older than cutoff by copying the rest into a lock file renamed over
+// the log. Returns the number of entries removed.
+long expireReflog(const char* name, time_t cutoff) {
+    long count;
+    FILE* file = openReflog(name, &count);
+    if (file == NULL) {
+        return 0;
+    }
+    long first = firstReflogEntryAfter(file, count, cutoff);
+    if (first == 0) {
+        fclose(file);
+        return 0;
+    }
+    char path[REF_PATH_LENGTH];
+    char lockPath[REF_PATH_LENGTH];
+    reflogPath(name, "", path);
+    reflogPath(name, ".lock", lockPath);
+    int descriptor = open(lockPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (descriptor < 0) {
+        printf("Error: Reflog of '%s' is locked by another writer.\n", name);
+        fclose(file);
+        return 0;
+    }
+    FILE* kept = fdopen(descriptor, "wb");
+    unsigned char bytes[REFLOG_RECORD_SIZE];
+    fseek(file, first * REFLOG_RECORD_SIZE, SEEK_SET);
+    while (fread(bytes, 1, REFLOG_RECORD_SIZE, file) == REFLOG_RECORD_SIZE) {
+        fwrite(bytes, 1, REFLOG_RECORD_SIZE, kept);
+    }
+    fclose(kept);
+    fclose(file);
+    replaceFile(lockPath, path);
+    return first;
+}
 
-    index = newCommit->fileID % N;
-    repo->nodes[index] = newNode;
+void printReflogRecord(const char* label, const reflogRecord* record) {
+    char when[20];
+    struct tm* tm_info = localtime(&record->time);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", tm_info);
+    printf("%s %s ", label, when);
+    if (record->newID == REFLOG_NO_COMMIT) {
+        printf("(deleted)");
+    } else {
+        printf("%d", record->newID);
+    }
+    printf(": %s\n", record->message);
+}
 
-    int currentBranchIndex = repo->currentBranchIndex;
-    if (currentBranchIndex >= 0) {
-        graphNode* parent = repo->nodes[currentBranchIndex];
-        if (parent != NULL) {
-            addParent(newNode, parent);
+// Shows the newest entries, reading only them from the end of the log
+void printReflog(const char* name, long limit) {
+    long count;
+    FILE* file = openReflog(name, &count);
+    if (file == NULL) {
+        printf("No reflog for '%s'.\n", name);
+        return;
+    }
+    reflogRecord record;
+    char label[REF_PATH_LENGTH];
+    for (long back = 0; back < limit && back < count && readReflogRecord(file, count - 1 - back, &record); back++) {
+        snprintf(label, sizeof(label), "%s@{%ld}", name, back);
+        printReflogRecord(label, &record);
+    }
+    fclose(file);
+}
+
+void initRefTransaction(refTransaction* transaction, const char* message) {
+    snprintf(transaction->message, sizeof(transaction->message), "%s", message);
+    transaction->count = 0;
+    transaction->capacity = 4;
+    transaction->updates = (refUpdate*)malloc(transaction->capacity * sizeof(refUpdate));
+}
+
+void freeRefTransaction(refTransaction* transaction) {
+    free(transaction->updates);
+}
+
+// Queues name: expectedOld -> newTip. A NULL expectedOld means the branch must not
+// exist yet and a NULL newTip deletes it.
+void addRefUpdate(refTransaction* transaction, const char* name, graphNode* expectedOld, graphNode* newTip) {
+    if (transaction->count == transaction->capacity) {
+        transaction->capacity *= 2;
+        transaction->updates = (refUpdate*)realloc(transaction->updates, transaction->capacity * sizeof(refUpdate));
+    }
+    refUpdate* update = &transaction->updates[transaction->count++];
+    snprintf(update->name, sizeof(update->name), "%s", name);
+    update->expectedOld = expectedOld;
+    update->newTip = newTip;
+    update->object = -1;
+    update->locked = 0;
+}
+
+void looseRefPath(const char* name, const char* suffix, char* path) {
+    snprintf(path, REF_PATH_LENGTH, "%s/%s%s", REFS_DIR, name, suffix);
+}
+
+void releaseRefLocks(refTransaction* transaction) {
+    char path[REF_PATH_LENGTH];
+    for (int i = 0; i < transaction->count; i++) {
+        if (transaction->updates[i].locked) {
+            looseRefPath(transaction->updates[i].name, ".lock", path);
+            remove(path);
+            transaction->updates[i].locked = 0;
         }
     }
+}
 
-    return newNode;
+int compareRefUpdates(const void* a, const void* b) {
+    return strcmp(((const refUpdate*)a)->name, ((const refUpdate*)b)->name);
+}
+
+// Whether the (sorted) transaction creates or moves a branch whose name is a directory
+// of another one it creates or moves, such as "x" and "x/y": the ref store checks in
+// validBranchName only see branches that already exist
+int hasDirectoryClash(const refTransaction* transaction) {
+    for (int i = 0; i < transaction->count; i++) {
+        const refUpdate* update = &transaction->updates[i];
+        if (update->newTip == NULL) {
+            continue;
+        }
+        for (const char* slash = strchr(update->name, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+            refUpdate key;
+            snprintf(key.name, sizeof(key.name), "%.*s", (int)(slash - update->name), update->name);
+            const refUpdate* parent = (const refUpdate*)bsearch(&key, transaction->updates, transaction->count,
+                                                                sizeof(refUpdate), compareRefUpdates);
+            if (parent != NULL && parent->newTip != NULL) {
+                printf("Error: Branches '%s' and '%s' conflict.\n", parent->name, update->name);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Applies every queued update or none. Each branch is checked against its expected old
+// tip in memory (compare-and-swap under the ref lock) and locked on disk by creating
+// <ref>.lock exclusively, so another process writing the same branch fails cleanly.
+// The new values go into the lock files, which are renamed over the loose refs only
+// once every branch has passed.
+int commitRefTransaction(repository* repo, refTransaction* transaction) {
+    qsort(transaction->updates, transaction->count, sizeof(refUpdate), compareRefUpdates);
+    for (int i = 1; i < transaction->count; i++) {
+        if (strcmp(transaction->updates[i - 1].name, transaction->updates[i].name) == 0) {
+            printf("Error: Branch '%s' is updated twice in one transaction.\n", transaction->updates[i].name);
+            return REF_TX_INVALID;
+        }
+    }
+    if (hasDirectoryClash(transaction)) {
+        return REF_TX_INVALID;
+    }
+    if (!ensureRepoDirectory()) {
+        printf("Error: Cannot create %s.\n", REPO_DIR);
+        return REF_TX_INVALID;
+    }
+
+    pthread_mutex_lock(&repo->refLock);
+    int result = REF_TX_OK;
+    char path[REF_PATH_LENGTH];
+    for (int i = 0; i < transaction->count && result == REF_TX_OK; i++) {
+        refUpdate* update = &transaction->updates[i];
+        int branchIndex = findBranch(repo, update->name);
+        graphNode* current = branchIndex != -1 ? repo->nodes[branchIndex] : NULL;
+        if (current != update->expectedOld) {
+            printf("Error: Branch '%s' has moved; update rejected.\n", update->name);
+            result = REF_TX_CONFLICT;
+        } else if (branchIndex == -1 && (update->newTip == NULL || !validBranchName(repo, update->name))) {
+            printf("Error: Invalid branch name '%s'.\n", update->name);
+            result = REF_TX_INVALID;
+        } else if (update->newTip == NULL && worktreeOnBranch(repo, branchIndex) != NULL) {
+            printf("Error: Cannot delete branch '%s', it is checked out.\n", update->name);
+            result = REF_TX_INVALID;
+        }
+        if (result != REF_TX_OK) {
+            break;
+        }
+
+        looseRefPath(update->name, ".lock", path);
+        makeParentDirectories(path);
+        int descriptor = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (descriptor < 0) {
+            printf("Error: Branch '%s' is locked by another writer.\n", update->name);
+            result = REF_TX_LOCKED;
+            break;
+        }
+        update->locked = 1;
+        if (update->newTip != NULL) {
+            char value[48];
+            int length = snprintf(value, sizeof(value), "%d\n", update->newTip->commit->fileID);
+            if (update->object >= 0) {
+                length += snprintf(value + length, sizeof(value) - length, "tag %d\n", update->object);
+            }
+            if (write(descriptor, value, length) != length) {
+                result = REF_TX_INVALID;
+            }
+        }
+        close(descriptor);
+    }
+
+    if (result != REF_TX_OK) {
+        releaseRefLocks(transaction);
+        pthread_mutex_unlock(&repo->refLock);
+        return result;
+    }
+
+    char lockPath[REF_PATH_LENGTH];
+    for (int i = 0; i < transaction->count; i++) {
+        refUpdate* update = &transaction->updates[i];
+        looseRefPath(update->name, "", path);
+        looseRefPath(update->name, ".lock", lockPath);
+        int branchIndex = findBranch(repo, update->name);
+        if (update->newTip == NULL) {
+            remove(path);
+            remove(lockPath);
+            reflogPath(update->name, "", path);
+            remove(path);
+            removeBranch(repo, branchIndex);
+        } else if (!replaceFile(lockPath, path)) {
+            printf("Error: Cannot write branch '%s'.\n", update->name);
+            remove(lockPath);
+            result = REF_TX_INVALID;
+        } else {
+            // Logged only once the new value is in place, so the reflog never shows a move that did not happen
+            appendReflog(update->name, update->expectedOld != NULL ? update->expectedOld->commit->fileID : REFLOG_NO_COMMIT,
+                         update->newTip->commit->fileID, transaction->message);
+            if (branchIndex == -1) {
+                branchIndex = addBranch(repo, update->name, update->newTip);
+            } else {
+                repo->nodes[branchIndex] = update->newTip;
+            }
+            repo->refObjects[branchIndex] = update->object;
+        }
+        update->locked = 0;
+    }
+    // The packed table is a snapshot of the store; once a ref moves it is out of date
+    remove(PACKED_REFS);
+    pthread_mutex_unlock(&repo->refLock);
+    return result;
+}
+
+// Moves one branch from expectedOld to newTip, failing if it was moved in between
+int updateBranch(repository* repo, const char* name, graphNode* expectedOld, graphNode* newTip, const char* message) {
+    refTransaction transaction;
+    initRefTransaction(&transaction, message);
+    addRefUpdate(&transaction, name, expectedOld, newTip);
+    int result = commitRefTransaction(repo, &transaction);
+    freeRefTransaction(&transaction);
+    return result;
+}
+
+//-----------------REPOSITORY-------------------------------------------
+
+worktree* createWorktree(const char* name, const char* root, int branchIndex) {
+    worktree* tree = (worktree*)calloc(1, sizeof(worktree));
+    snprintf(tree->name, sizeof(tree->name), "%s", name);
+    snprintf(tree->root, sizeof(tree->root), "%s", root);
+    tree->currentBranchIndex = branchIndex;
+    tree->pendingResolutions = NULL;
+    tree->merge = NULL;
+    tree->next = NULL;
+    return tree;
+}
+
+repository* initRepository(const char* repoName) {
+    repository* newRepo = (repository*)malloc(sizeof(repository));
+    if (newRepo == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        return NULL;
+    }
+
+    for (int i = 0; i < N; i++) {
+        newRepo->fileHash[i] = NULL;
+    }
+    newRepo->branchCapacity = 8;
+    newRepo->nodes = (graphNode**)calloc(newRepo->branchCapacity, sizeof(graphNode*));
+    newRepo->branches = (char**)calloc(newRepo->branchCapacity, sizeof(char*));
+    newRepo->refObjects = (int*)calloc(newRepo->branchCapacity, sizeof(int));
+    newRepo->aheadBehind = (aheadBehindEntry*)calloc(newRepo->branchCapacity, sizeof(aheadBehindEntry));
+    newRepo->refRoot = NULL;
+    pthread_mutex_init(&newRepo->refLock, NULL);
+    for (int i = 0; i < COMMIT_INDEX_SIZE; i++) {
+        newRepo->commitIndex[i] = NULL;
+    }
+    newRepo->mergeBases = (mergeBaseCache*)calloc(1, sizeof(mergeBaseCache));
+    newRepo->worktrees = createWorktree("", "", 0);
+    newRepo->worktree = newRepo->worktrees;
+    newRepo->branchCount = 0;
+
+    // A packed table left by an earlier session names commits by that session's IDs
+    remove(PACKED_REFS);
+
+    graphNode* repoNode = createRepoNode(repoName);
+    addBranch(newRepo, "main", repoNode);
+    registerCommit(newRepo, repoNode);
+
+    return newRepo;
+}
+
+void addParent(graphNode* child, graphNode* parent) {
+    parent->nextParent = child->parent;
+    child->parent = parent;
+}
+
+// Continues hashBytes over more data: hashBytes(a + b) == hashMoreBytes(hashBytes(a), b)
+unsigned long long hashMoreBytes(unsigned long long hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+unsigned long long hashBytes(const char* data, size_t length) {
+    return hashMoreBytes(1469598103934665603ULL, data, length);
+}
+
+unsigned long long mixHash(unsigned long long value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+//-----------------BINARY DELTA-----------------------------------------
+
+// Binary if the first BINARY_CHECK_SIZE bytes hold a NUL or too many non-text bytes
+int isBinaryContent(const char* data, size_t size) {
+    size_t checked = size < BINARY_CHECK_SIZE ? size : BINARY_CHECK_SIZE;
+    size_t nonText = 0;
+    for (size_t i = 0; i < checked; i++) {
+        unsigned char c = (unsigned char)data[i];
+        if (c == 0) {
+            return 1;
+        }
+        if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\b') || c == 0x7f) {
+            nonText++;
+        }
+    }
+    return checked > 0 && nonText * 100 / checked > BINARY_NON_TEXT_PERCENT;
+}
+
+char* readWholeFile(const char* fileName, size_t* size) {
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t capacity = 4096;
+    size_t length = 0;
+    char* data = (char*)malloc(capacity);
+    size_t bytesRead;
+    while ((bytesRead = fread(data + length, 1, capacity - length, file)) > 0) {
+        length += bytesRead;
+        if (length == capacity) {
+            capacity *= 2;
+            data = (char*)realloc(data, capacity);
+        }
+    }
+    fclose(file);
+    *size = length;
+    return data;
+}
+
+int writeWholeFile(const char* fileName, const char* data, size_t size) {
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t written = fwrite(data, 1, size, file);
+    fclose(file);
+    return written == size;
+}
+
+void appendDeltaBytes(deltaBuffer* delta, const unsigned char* bytes, size_t count) {
+    if (delta->size + count > delta->capacity) {
+        while (delta->size + count > delta->capacity) {
+            delta->capacity = delta->capacity > 0 ? delta->capacity * 2 : 256;
+        }
+        delta->data = (unsigned char*)realloc(delta->data, delta->capacity);
+    }
+    memcpy(delta->data + delta->size, bytes, count);
+    delta->size += count;
+}
+
+void appendDeltaVarint(deltaBuffer* delta, size_t value) {
+    unsigned char byte;
+    do {
+        byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0) {
+            byte |= 0x80;
+        }
+        appendDeltaBytes(delta, &byte, 1);
+    } while (value != 0);
+}
+
+void appendDeltaInsert(deltaBuffer* delta, const char* data, size_t length) {
+    while (length > 0) {
+        unsigned char chunk = length > DELTA_MAX_INSERT ? DELTA_MAX_INSERT : (unsigned char)length;
+        appendDeltaBytes(delta, &chunk, 1);
+        appendDeltaBytes(delta, (const unsigned char*)data, chunk);
+        data += chunk;
+        length -= chunk;
+        delta->insertOps++;
+    }
+}
+
+// Copy opcode: high bit set, low 4 bits flag offset bytes, next 3 bits flag size bytes.
+// Source bytes past DELTA_MAX_OFFSET cannot be addressed, so they are inserted literally.
+void appendDeltaCopy(deltaBuffer* delta, const char* source, size_t offset, size_t length) {
+    while (length > 0) {
+        if ((unsigned long long)offset > DELTA_MAX_OFFSET) {
+            appendDeltaInsert(delta, source + offset, length);
+            return;
+        }
+        size_t chunk = length > DELTA_MAX_COPY ? DELTA_MAX_COPY : length;
+        unsigned char op[8];
+        int used = 1;
+        op[0] = 0x80;
+        for (int i = 0; i < 4; i++) {
+            unsigned char byte = (offset >> (8 * i)) & 0xff;
+            if (byte != 0) {
+                op[0] |= 1 << i;
+                op[used++] = byte;
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            unsigned char byte = (chunk >> (8 * i)) & 0xff;
+            if (byte != 0) {
+                op[0] |= 1 << (4 + i);
+                op[used++] = byte;
+            }
+        }
+        appendDeltaBytes(delta, op, used);
+        offset += chunk;
+        length -= chunk;
+        delta->copyOps++;
+    }
+}
+
+unsigned int windowHash(const unsigned char* data) {
+    unsigned int hash = 0;
+    for (int i = 0; i < DELTA_WINDOW; i++) {
+        hash = hash * DELTA_HASH_BASE + data[i];
+    }
+    return hash;
+}
+
+// Encodes target as copy/insert opcodes against source. Source blocks are indexed by a
+// rolling hash, and the target is scanned once, so the cost is linear in both sizes.
+deltaBuffer* createDelta(const char* source, size_t sourceSize, const char* target, size_t targetSize) {
+    const unsigned char* src = (const unsigned char*)source;
+    const unsigned char* tgt = (const unsigned char*)target;
+    deltaBuffer* delta = (deltaBuffer*)calloc(1, sizeof(deltaBuffer));
+    appendDeltaVarint(delta, sourceSize);
+    appendDeltaVarint(delta, targetSize);
+
+    size_t blockCount = sourceSize / DELTA_WINDOW;
+    if (blockCount == 0 || targetSize < DELTA_WINDOW) {
+        appendDeltaInsert(delta, target, targetSize);
+        return delta;
+    }
+
+    size_t indexSize = 16;
+    while (indexSize < blockCount * 2) {
+        indexSize *= 2;
+    }
+    long* index = (long*)malloc(indexSize * sizeof(long));
+    for (size_t i = 0; i < indexSize; i++) {
+        index[i] = -1;
+    }
+    for (size_t block = 0; block < blockCount; block++) {
+        size_t slot = windowHash(src + block * DELTA_WINDOW) & (indexSize - 1);
+        if (index[slot] == -1) {
+            index[slot] = (long)(block * DELTA_WINDOW);
+        }
+    }
+
+    unsigned int power = 1;
+    for (int i = 1; i < DELTA_WINDOW; i++) {
+        power *= DELTA_HASH_BASE;
+    }
+
+    size_t insertStart = 0;
+    size_t position = 0;
+    unsigned int hash = windowHash(tgt);
+    while (position + DELTA_WINDOW <= targetSize) {
+        long candidate = index[hash & (indexSize - 1)];
+        if (candidate >= 0 && memcmp(src + candidate, tgt + position, DELTA_WINDOW) == 0) {
+            size_t matchSource = (size_t)candidate;
+            size_t matchTarget = position;
+            while (matchSource > 0 && matchTarget > insertStart && src[matchSource - 1] == tgt[matchTarget - 1]) {
+                matchSource--;
+                matchTarget--;
+            }
+            size_t length = position - matchTarget + DELTA_WINDOW;
+            while (matchSource + length < sourceSize && matchTarget + length < targetSize &&
+                   src[matchSource + length] == tgt[matchTarget + length]) {
+                length++;
+            }
+
+            appendDeltaInsert(delta, target + insertStart, matchTarget - insertStart);
+            appendDeltaCopy(delta, source, matchSource, length);
+            position = matchTarget + length;
+            insertStart = position;
+            if (position + DELTA_WINDOW <= targetSize) {
+                hash = windowHash(tgt + position);
+            }
+            continue;
+        }
+
+        if (position + DELTA_WINDOW < targetSize) {
+            hash = (hash - tgt[position] * power) * DELTA_HASH_BASE + tgt[position + DELTA_WINDOW];
+        }
+        position++;
+    }
+    appendDeltaInsert(delta, target + insertStart, targetSize - insertStart);
+
+    free(index);
+    return delta;
+}
+
+void freeDelta(deltaBuffer* delta) {
+    if (delta != NULL) {
+        free(delta->data);
+        free(delta);
+    }
+}
+
+int readDeltaVarint(const unsigned char** cursor, const unsigned char* end, size_t* value) {
+    size_t result = 0;
+    int shift = 0;
+    while (*cursor < end) {
+        unsigned char byte = *(*cursor)++;
+        result |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+// Rebuilds the target from source and delta; returns NULL if the delta is corrupt or for another source
+char* applyDelta(const char* source, size_t sourceSize, const unsigned char* delta, size_t deltaSize, size_t* targetSize) {
+    const unsigned char* cursor = delta;
+    const unsigned char* end = delta + deltaSize;
+    size_t expectedSource;
+    size_t expectedTarget;
+    if (!readDeltaVarint(&cursor, end, &expectedSource) || !readDeltaVarint(&cursor, end, &expectedTarget) ||
+        expectedSource != sourceSize) {
+        return NULL;
+    }
+
+    char* target = (char*)malloc(expectedTarget > 0 ? expectedTarget : 1);
+    size_t length = 0;
+    while (cursor < end) {
+        unsigned char op = *cursor++;
+        if (op & 0x80) {
+            size_t offset = 0;
+            size_t size = 0;
+            for (int i = 0; i < 4; i++) {
+                if (op & (1 << i)) {
+                    if (cursor == end) {
+                        free(target);
+                        return NULL;
+                    }
+                    offset |= (size_t)*cursor++ << (8 * i);
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                if (op & (1 << (4 + i))) {
+                    if (cursor == end) {
+                        free(target);
+                        return NULL;
+                    }
+                    size |= (size_t)*cursor++ << (8 * i);
+                }
+            }
+            if (offset + size > sourceSize || length + size > expectedTarget) {
+                free(target);
+                return NULL;
+            }
+            memcpy(target + length, source + offset, size);
+            length += size;
+        } else if (op != 0) {
+            if ((size_t)(end - cursor) < op || length + op > expectedTarget) {
+                free(target);
+                return NULL;
+            }
+            memcpy(target + length, cursor, op);
+            cursor += op;
+            length += op;
+        } else {
+            free(target);
+            return NULL;
+        }
+    }
+
+    if (length != expectedTarget) {
+        free(target);
+        return NULL;
+    }
+    *targetSize = length;
+    return target;
+}
+
+void printBinaryChanges(const char* originalFileName, const char* originalData, size_t originalSize,
+                        const char* updatedFileName, const char* updatedData, size_t updatedSize) {
+    if (originalSize == updatedSize && memcmp(originalData, updatedData, originalSize) == 0) {
+        printf("No differences found between %s and %s.\n", originalFileName, updatedFileName);
+        return;
+    }
+    deltaBuffer* delta = createDelta(originalData, originalSize, updatedData, updatedSize);
+    printf("Binary files %s and %s differ\n", originalFileName, updatedFileName);
+    printf("Size: %zu -> %zu bytes, delta: %zu bytes (%d copy, %d insert ops)\n",
+           originalSize, updatedSize, delta->size, delta->copyOps, delta->insertOps);
+    freeDelta(delta);
+}
+
+// The line starting at *position, newline included; NULL at the end of the data
+const char* nextLine(const char* data, size_t size, size_t* position, int* length) {
+    if (*position >= size) {
+        return NULL;
+    }
+    const char* line = data + *position;
+    const char* newline = (const char*)memchr(line, '\n', size - *position);
+    size_t lineLength = newline != NULL ? (size_t)(newline - line) + 1 : size - *position;
+    *position += lineLength;
+    *length = (int)lineLength;
+    return line;
+}
+
+// Both files are read once; binary vs text is decided from those buffers and the text
+// comparison walks their lines
+void printFileChanges(const char* originalFileName, const char* updatedFileName) {
+    size_t originalSize;
+    size_t updatedSize;
+    char* originalData = readWholeFile(originalFileName, &originalSize);
+    char* updatedData = readWholeFile(updatedFileName, &updatedSize);
+    if (originalData == NULL || updatedData == NULL) {
+        printf("Error: Unable to open file.\n");
+        free(originalData);
+        free(updatedData);
+        return;
+    }
+
+    if (isBinaryContent(originalData, originalSize) || isBinaryContent(updatedData, updatedSize)) {
+        printBinaryChanges(originalFileName, originalData, originalSize, updatedFileName, updatedData, updatedSize);
+        free(originalData);
+        free(updatedData);
+        return;
+    }
+
+    printf("Changes between %s and %s:\n", originalFileName, updatedFileName);
+
+    size_t originalPosition = 0;
+    size_t updatedPosition = 0;
+    int lineNum = 1;
+    int differencesFound = 0;
+    while (1) {
+        int originalLength;
+        int updatedLength;
+        const char* originalLine = nextLine(originalData, originalSize, &originalPosition, &originalLength);
+        const char* updatedLine = nextLine(updatedData, updatedSize, &updatedPosition, &updatedLength);
+        if (originalLine == NULL && updatedLine == NULL) {
+            break;
+        }
+        if (originalLine == NULL || updatedLine == NULL || originalLength != updatedLength ||
+            memcmp(originalLine, updatedLine, originalLength) != 0) {
+            printf("Difference found in line %d:\n", lineNum);
+            if (originalLine != NULL) {
+                printf("Original: %.*s", originalLength, originalLine);
+            } else {
+                printf("Original: (End of file)\n");
+            }
+            if (updatedLine != NULL) {
+                printf("Updated: %.*s", updatedLength, updatedLine);
+            } else {
+                printf("Updated: (End of file)\n");
+            }
+            printf("\n");
+            differencesFound = 1;
+        }
+        lineNum++;
+    }
+
+    if (!differencesFound) {
+        printf("No differences found between %s and %s.\n", originalFileName, updatedFileName);
+    }
+
+    free(originalData);
+    free(updatedData);
+}
+
+File* findFile(int fileID, repository* repo) {
+    if (fileID < 0) {
+        return NULL;
+    }
+    File* currentFile = repo->fileHash[fileID % N];
+    while (currentFile != NULL) {
+        if (currentFile->fileID == fileID) {
+            return currentFile;
+        }
+        currentFile = currentFile->next;
+    }
+    return NULL;
+}
+
+// Defined with the three-way merge
+int mergeResolved(repository* repo);
+snapshot* resolvedMergeTree(repository* repo, const char* fileName, int fileID);
+void clearPendingMerge(worktree* tree);
+
+// While a conflicted merge is pending the commit concludes it: its tree is the merge
+// result with the resolved files, and the other merged tip becomes its second parent
+graphNode* commit_file(const char* fileName, const char* message, int id, const char* author, repository* repo) {
+    // The commit index, snapshots and merge-base cache all key on unique IDs
+    if (findFile(id, repo) != NULL || findCommit(repo, id) != NULL) {
+        printf("Error: ID %d is already in use.\n", id);
+        return NULL;
+    }
+    if (repo->worktree->merge != NULL && !mergeResolved(repo)) {
+        return NULL;
+    }
+    char location[WORKING_PATH_LENGTH];
+    FILE* file = fopen(workingPath(repo, fileName, location), "rb");
+    if (file == NULL) {
+        printf("Error: Unable to open file.\n");
+        return NULL;
+    }
+
+    File* newFile = (File*)malloc(sizeof(File));
+    if (newFile == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        fclose(file);
+        return NULL;
+    }
+
+    newFile->size = fread(newFile->content, 1, sizeof(newFile->content) - 1, file);
+    if (fgetc(file) != EOF) {
+        // A blob cut at the buffer size would silently commit a corrupted file
+        printf("Error: %s is larger than the %d-byte file limit; nothing committed.\n", fileName,
+               MAX_FILE_CONTENT_SIZE - 1);
+        fclose(file);
+        free(newFile);
+        return NULL;
+    }
+    newFile->content[newFile->size] = '\0';
+    newFile->fileID = id;
+    newFile->next = NULL;
+    if (id >= nextFileID) {
+        nextFileID = id + 1;
+    }
+    newFile->contentHash = hashBytes(newFile->content, newFile->size);
+
+    int index = id % N;
+    if (repo->fileHash[index] == NULL) {
+        repo->fileHash[index] = newFile;
+    } else {
+        newFile->next = repo->fileHash[index];
+        repo->fileHash[index] = newFile;
+    }
+
+    commit* newCommit = (commit*)malloc(sizeof(commit));
+    if (newCommit == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        fclose(file);
+        return NULL;
+    }
+
+    snprintf(newCommit->message, sizeof(newCommit->message), "%s", message);
+    newCommit->fileID = newFile->fileID;
+    newCommit->fileCount = 1;
+    newCommit->fileIDs[0] = newFile->fileID;
+    snprintf(newCommit->author, sizeof(newCommit->author), "%s", author);
+    snprintf(newCommit->originalFileName, sizeof(newCommit->originalFileName), "%s", fileName);
+
+    time_t t = time(NULL);
+    struct tm* tm_info = localtime(&t);
+    strftime(newCommit->timestamp, sizeof(newCommit->timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+
+    fclose(file);
+
+    graphNode* newNode = createGraphNode(newCommit);
+    int concludesMerge = repo->worktree->merge != NULL;
+    if (concludesMerge) {
+        newNode->tree = resolvedMergeTree(repo, fileName, newFile->fileID);
+        newNode->mergeParent = repo->worktree->merge->theirs;
+    }
+
+    registerCommit(repo, newNode);
+
+    int currentBranchIndex = repo->worktree->currentBranchIndex;
+    if (currentBranchIndex >= 0) {
+        graphNode* parent = repo->nodes[currentBranchIndex];
+        if (parent != NULL) {
+            addParent(newNode, parent);
+        }
+        // Advance the branch tip, unless someone else moved it meanwhile
+        char reason[REFLOG_MESSAGE_LENGTH];
+        if (concludesMerge) {
+            snprintf(reason, sizeof(reason), "commit (merge): %.31s", message);
+        } else {
+            snprintf(reason, sizeof(reason), "commit: %.39s", message);
+        }
+        if (updateBranch(repo, repo->branches[currentBranchIndex], parent, newNode, reason) == REF_TX_OK &&
+            concludesMerge) {
+            clearPendingMerge(repo->worktree);
+            printf("Merge concluded with commit %d.\n", newNode->commit->fileID);
+        }
+    }
+
+    return newNode;
+}
+
+void printFileContent(const File* file) {
+    if (isBinaryContent(file->content, file->size)) {
+        printf("Content: (binary, %zu bytes)\n", file->size);
+    } else {
+        printf("Content:\n%s\n", file->content);
+    }
+}
+
+void printFileList() {
+    printf("File List:\n");
+    File* temp = head;
+    while (temp != NULL) {
+        printf("File ID: %d\n", temp->fileID);
+        printFileContent(temp);
+        temp = temp->next;
+    }
+}
+
+// A new branch shares the original's commits: only the tip pointer is copied
+void cloneBranch(repository* repo, const char* originalBranchName, const char* newBranchName) {
+    int originalBranchIndex = findBranch(repo, originalBranchName);
+    if (originalBranchIndex == -1) {
+        printf("Error: Original branch '%s' not found.\n", originalBranchName);
+        return;
+    }
+
+    if (findBranch(repo, newBranchName) != -1 || !validBranchName(repo, newBranchName) || isTagRef(newBranchName)) {
+        printf("Error: Invalid or existing branch name '%s'.\n", newBranchName);
+        return;
+    }
+    char reason[REFLOG_MESSAGE_LENGTH];
+    snprintf(reason, sizeof(reason), "branch: created from %.26s", originalBranchName);
+    if (updateBranch(repo, newBranchName, NULL, repo->nodes[originalBranchIndex], reason) == REF_TX_OK) {
+        printf("Branch '%s' created from branch '%s'.\n", newBranchName, originalBranchName);
+    }
+}
+
+void createBranch(repository* repo, const char* branchName) {
+    if (findBranch(repo, branchName) != -1) {
+        printf("Error: Branch '%s' already exists.\n", branchName);
+        return;
+    }
+    if (!validBranchName(repo, branchName) || isTagRef(branchName)) {
+        printf("Error: Invalid branch name '%s'.\n", branchName);
+        return;
+    }
+
+    const char* originalBranchName = repo->branches[repo->worktree->currentBranchIndex];
+    cloneBranch(repo, originalBranchName, branchName);
+}
+
+void freeCommitTree(graphNode* root) {
+    if (root != NULL) {
+        freeCommitTree(root->nextParent);
+        free(root->commit);
+        free(root);
+    }
+}
+
+void printBranchTip(repository* repo, int refIndex, void* context) {
+    (void)context;
+    graphNode* tip = repo->nodes[refIndex];
+    char marker = refIndex == repo->worktree->currentBranchIndex ? '*' : worktreeOnBranch(repo, refIndex) != NULL ? '+' : ' ';
+    printf("%c %s -> %d\n", marker, repo->branches[refIndex],
+           tip != NULL ? tip->commit->fileID : -1);
+}
+
+void printRepository(repository* repo) {
+    printf("Repository Contents:\n");
+    printf("Current Branch Index: %d\n", repo->worktree->currentBranchIndex);
+    printf("Branch Count: %d\n", repo->branchCount);
+
+    printf("Branches:\n");
+    for (int i = 0; i < repo->branchCount; i++) {
+        printf("%d: %s\n", i, repo->branches[i]);
+    }
+
+    printf("File Hash:\n");
+    for (int i = 0; i < N; i++) {
+        printf("Index %d:\n", i);
+        File* file = repo->fileHash[i];
+        while (file != NULL) {
+            printf("File ID: %d\n", file->fileID);
+            printFileContent(file);
+            file = file->next;
+        }
+    }
+
+    printf("Commit Nodes:\n");
+    for (int i = 0; i < repo->branchCount; i++) {
+        printf("Index %d:\n", i);
+        graphNode* node = repo->nodes[i];
+        while (node != NULL) {
+            printf("Message: %s\n", node->commit->message);
+            printf("File ID: %d\n", node->commit->fileID);
+            printf("Author: %s\n", node->commit->author);
+            printf("Timestamp: %s\n", node->commit->timestamp);
+            node = node->nextParent;
+        }
+    }
+}
+
+void initNodeSet(nodeSet* set) {
+    set->count = 0;
+    set->capacity = 64;
+    set->slots = (graphNode**)calloc(set->capacity, sizeof(graphNode*));
+    set->values = (int*)calloc(set->capacity, sizeof(int));
+}
+
+void freeNodeSet(nodeSet* set) {
+    free(set->slots);
+    free(set->values);
+}
+
+size_t nodeSlot(const graphNode* node, int capacity) {
+    return (size_t)(mixHash((unsigned long long)(size_t)node) & (unsigned long long)(capacity - 1));
+}
+
+int findNodeSlot(const nodeSet* set, const graphNode* node) {
+    size_t slot = nodeSlot(node, set->capacity);
+    while (set->slots[slot] != NULL) {
+        if (set->slots[slot] == node) {
+            return (int)slot;
+        }
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    return -1;
+}
+
+int nodeSetContains(const nodeSet* set, const graphNode* node) {
+    return findNodeSlot(set, node) >= 0;
+}
+
+// Returns the value stored for the node, inserting it with value 0 if absent
+int* nodeSetValue(nodeSet* set, graphNode* node) {
+    int existing = findNodeSlot(set, node);
+    if (existing >= 0) {
+        return &set->values[existing];
+    }
+    if ((set->count + 1) * 2 > set->capacity) {
+        graphNode** oldSlots = set->slots;
+        int* oldValues = set->values;
+        int oldCapacity = set->capacity;
+        set->capacity *= 2;
+        set->slots = (graphNode**)calloc(set->capacity, sizeof(graphNode*));
+        set->values = (int*)calloc(set->capacity, sizeof(int));
+        for (int i = 0; i < oldCapacity; i++) {
+            if (oldSlots[i] != NULL) {
+                size_t slot = nodeSlot(oldSlots[i], set->capacity);
+                while (set->slots[slot] != NULL) {
+                    slot = (slot + 1) & (set->capacity - 1);
+                }
+                set->slots[slot] = oldSlots[i];
+                set->values[slot] = oldValues[i];
+            }
+        }
+        free(oldSlots);
+        free(oldValues);
+    }
+    size_t slot = nodeSlot(node, set->capacity);
+    while (set->slots[slot] != NULL) {
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    set->slots[slot] = node;
+    set->values[slot] = 0;
+    set->count++;
+    return &set->values[slot];
+}
+
+// Returns 1 if the node was newly added
+int nodeSetAdd(nodeSet* set, graphNode* node) {
+    if (nodeSetContains(set, node)) {
+        return 0;
+    }
+    nodeSetValue(set, node);
+    return 1;
+}
+
+// Generation number: 1 for root commits, otherwise one more than the highest parent.
+// Computed lazily with an explicit stack so long histories do not recurse deeply.
+int getGeneration(graphNode* node) {
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->generation > 0) {
+        return node->generation;
+    }
+
+    int capacity = 64;
+    int top = 0;
+    graphNode** stack = (graphNode**)malloc(capacity * sizeof(graphNode*));
+    stack[top++] = node;
+    while (top > 0) {
+        graphNode* current = stack[top - 1];
+        graphNode* parents[2] = {current->parent, current->mergeParent};
+        int pending = 0;
+        int highest = 0;
+        for (int p = 0; p < 2; p++) {
+            if (parents[p] == NULL) {
+                continue;
+            }
+            if (parents[p]->generation == 0) {
+                if (top == capacity) {
+                    capacity *= 2;
+                    stack = (graphNode**)realloc(stack, capacity * sizeof(graphNode*));
+                }
+                stack[top++] = parents[p];
+                pending = 1;
+            } else if (parents[p]->generation > highest) {
+                highest = parents[p]->generation;
+            }
+        }
+        if (!pending) {
+            current->generation = highest + 1;
+            top--;
+        }
+    }
+    free(stack);
+    return node->generation;
+}
+
+// Highest generation first, ties broken by commit ID so walks are deterministic
+int nodeBefore(graphNode* a, graphNode* b) {
+    int generationA = getGeneration(a);
+    int generationB = getGeneration(b);
+    if (generationA != generationB) {
+        return generationA > generationB;
+    }
+    return a->commit->fileID > b->commit->fileID;
+}
+
+void heapPush(nodeHeap* heap, graphNode* node, int active) {
+    if (heap->count == heap->capacity) {
+        heap->capacity = heap->capacity > 0 ? heap->capacity * 2 : 64;
+        heap->items = (graphNode**)realloc(heap->items, heap->capacity * sizeof(graphNode*));
+        heap->active = (char*)realloc(heap->active, heap->capacity);
+    }
+    int index = heap->count++;
+    while (index > 0 && nodeBefore(node, heap->items[(index - 1) / 2])) {
+        heap->items[index] = heap->items[(index - 1) / 2];
+        heap->active[index] = heap->active[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    heap->items[index] = node;
+    heap->active[index] = (char)active;
+    heap->activeCount += active;
+}
+
+graphNode* heapPop(nodeHeap* heap) {
+    graphNode* top = heap->items[0];
+    heap->activeCount -= heap->active[0];
+    graphNode* last = heap->items[--heap->count];
+    char lastActive = heap->active[heap->count];
+    int index = 0;
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && nodeBefore(heap->items[child + 1], heap->items[child])) {
+            child++;
+        }
+        if (!nodeBefore(heap->items[child], last)) {
+            break;
+        }
+        heap->items[index] = heap->items[child];
+        heap->active[index] = heap->active[child];
+        index = child;
+    }
+    heap->items[index] = last;
+    heap->active[index] = lastActive;
+    return top;
+}
+
+void freeNodeHeap(nodeHeap* heap) {
+    free(heap->items);
+    free(heap->active);
+}
+
+// Walks from the descendant towards the root, never below the ancestor's generation
+int isAncestor(graphNode* ancestor, graphNode* descendant) {
+    if (ancestor == NULL || descendant == NULL) {
+        return 0;
+    }
+    if (ancestor == descendant || descendant->parent == ancestor || descendant->mergeParent == ancestor) {
+        return 1;
+    }
+    int floor = getGeneration(ancestor);
+    if (floor >= getGeneration(descendant)) {
+        return 0;
+    }
+    nodeSet seen;
+    initNodeSet(&seen);
+    int capacity = 64;
+    int top = 0;
+    graphNode** stack = (graphNode**)malloc(capacity * sizeof(graphNode*));
+    stack[top++] = descendant;
+    nodeSetAdd(&seen, descendant);
+    int found = 0;
+    while (top > 0 && !found) {
+        graphNode* current = stack[--top];
+        if (current == ancestor) {
+            found = 1;
+            break;
+        }
+        graphNode* parents[2] = {current->parent, current->mergeParent};
+        for (int p = 0; p < 2; p++) {
+            if (parents[p] != NULL && getGeneration(parents[p]) >= floor && nodeSetAdd(&seen, parents[p])) {
+                if (top == capacity) {
+                    capacity *= 2;
+                    stack = (graphNode**)realloc(stack, capacity * sizeof(graphNode*));
+                }
+                stack[top++] = parents[p];
+            }
+        }
+    }
+    free(stack);
+    freeNodeSet(&seen);
+    return found;
+}
+
+int compareNodesByGeneration(const void* a, const void* b) {
+    graphNode* nodeA = *(graphNode* const*)a;
+    graphNode* nodeB = *(graphNode* const*)b;
+    if (nodeA == nodeB) {
+        return 0;
+    }
+    return nodeBefore(nodeA, nodeB) ? -1 : 1;
+}
+
+// All best common ancestors: common ancestors that are not ancestors of another one.
+// Both tips paint their ancestry in generation order; a node reached from both sides is
+// a candidate and everything below it is marked stale, so the walk stops early.
+int findBestCommonAncestors(graphNode* commit1, graphNode* commit2, graphNode*** result) {
+    *result = NULL;
+    if (commit1 == NULL || commit2 == NULL) {
+        return 0;
+    }
+    if (commit1 == commit2) {
+        *result = (graphNode**)malloc(sizeof(graphNode*));
+        (*result)[0] = commit1;
+        return 1;
+    }
+
+    nodeSet flags;
+    nodeHeap heap = {NULL, NULL, 0, 0, 0};
+    initNodeSet(&flags);
+    *nodeSetValue(&flags, commit1) |= FLAG_PARENT1;
+    *nodeSetValue(&flags, commit2) |= FLAG_PARENT2;
+    heapPush(&heap, commit1, 1);
+    heapPush(&heap, commit2, 1);
+
+    int count = 0;
+    int capacity = 4;
+    graphNode** candidates = (graphNode**)malloc(capacity * sizeof(graphNode*));
+    while (heap.count > 0 && heap.activeCount > 0) {
+        graphNode* node = heapPop(&heap);
+        int* nodeFlags = nodeSetValue(&flags, node);
+        int paint = *nodeFlags & (FLAG_PARENT1 | FLAG_PARENT2 | FLAG_STALE);
+        if ((paint & (FLAG_PARENT1 | FLAG_PARENT2)) == (FLAG_PARENT1 | FLAG_PARENT2)) {
+            if (!(*nodeFlags & FLAG_RESULT)) {
+                *nodeFlags |= FLAG_RESULT;
+                if (count == capacity) {
+                    capacity *= 2;
+                    candidates = (graphNode**)realloc(candidates, capacity * sizeof(graphNode*));
+                }
+                candidates[count++] = node;
+            }
+            paint |= FLAG_STALE;
+        }
+        graphNode* parents[2] = {node->parent, node->mergeParent};
+        for (int p = 0; p < 2; p++) {
+            if (parents[p] == NULL) {
+                continue;
+            }
+            int* parentFlags = nodeSetValue(&flags, parents[p]);
+            if ((*parentFlags & paint) == paint) {
+                continue;
+            }
+            *parentFlags |= paint;
+            heapPush(&heap, parents[p], !(paint & FLAG_STALE));
+        }
+    }
+
+    // Drop candidates that were later painted stale or are ancestors of another candidate
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (!(*nodeSetValue(&flags, candidates[i]) & FLAG_STALE)) {
+            candidates[kept++] = candidates[i];
+        }
+    }
+    count = kept;
+    kept = 0;
+    for (int i = 0; i < count; i++) {
+        int redundant = 0;
+        for (int j = 0; j < count && !redundant; j++) {
+            redundant = i != j && isAncestor(candidates[i], candidates[j]);
+        }
+        if (!redundant) {
+            candidates[kept++] = candidates[i];
+        }
+    }
+    count = kept;
+    qsort(candidates, count, sizeof(graphNode*), compareNodesByGeneration);
+
+    freeNodeHeap(&heap);
+    freeNodeSet(&flags);
+    if (count == 0) {
+        free(candidates);
+        return 0;
+    }
+    *result = candidates;
+    return count;
+}
+
+// The best common ancestor with the highest generation (ties by commit ID)
+graphNode* findCommonAncestor(graphNode* commit1, graphNode* commit2) {
+    graphNode** bases;
+    int count = findBestCommonAncestors(commit1, commit2, &bases);
+    graphNode* ancestor = count > 0 ? bases[0] : NULL;
+    free(bases);
+    return ancestor;
+}
+
+//-----------------AHEAD/BEHIND-----------------------------------------
+
+// Counts commits reachable from tip but not base (ahead) and the reverse (behind).
+// Both sides are painted in generation order as in findBestCommonAncestors; a node is
+// final when popped, and the walk stops once only commits common to both remain.
+void countAheadBehind(graphNode* tip, graphNode* base, int* ahead, int* behind) {
+    *ahead = 0;
+    *behind = 0;
+    if (tip == NULL || base == NULL || tip == base) {
+        return;
+    }
+    nodeSet flags;
+    nodeHeap heap = {NULL, NULL, 0, 0, 0};
+    initNodeSet(&flags);
+    *nodeSetValue(&flags, tip) |= FLAG_PARENT1;
+    *nodeSetValue(&flags, base) |= FLAG_PARENT2;
+    heapPush(&heap, tip, 1);
+    heapPush(&heap, base, 1);
+
+    while (heap.count > 0 && heap.activeCount > 0) {
+        graphNode* node = heapPop(&heap);
+        int* nodeFlags = nodeSetValue(&flags, node);
+        if (*nodeFlags & FLAG_COUNTED) {
+            continue;
+        }
+        *nodeFlags |= FLAG_COUNTED;
+        int paint = *nodeFlags & (FLAG_PARENT1 | FLAG_PARENT2 | FLAG_STALE);
+        if ((paint & (FLAG_PARENT1 | FLAG_PARENT2)) == (FLAG_PARENT1 | FLAG_PARENT2)) {
+            paint |= FLAG_STALE;
+        } else if (!(paint & FLAG_STALE)) {
+            if (paint & FLAG_PARENT1) {
+                (*ahead)++;
+            } else {
+                (*behind)++;
+            }
+        }
+        graphNode* parents[2] = {node->parent, node->mergeParent};
+        for (int p = 0; p < 2; p++) {
+            if (parents[p] == NULL) {
+                continue;
+            }
+            int* parentFlags = nodeSetValue(&flags, parents[p]);
+            if ((*parentFlags & paint) == paint) {
+                continue;
+            }
+            *parentFlags |= paint;
+            heapPush(&heap, parents[p], !(paint & FLAG_STALE));
+        }
+    }
+    freeNodeHeap(&heap);
+    freeNodeSet(&flags);
+}
+
+// Number of plain (non-merge) commits from newer down its first parents to older, or -1
+// when older is not reached that way within AHEAD_BEHIND_STEP_LIMIT commits. *lowest is
+// the first commit after older.
+int linearStepsBetween(graphNode* older, graphNode* newer, graphNode** lowest) {
+    int steps = 0;
+    for (graphNode* current = newer; current != NULL && steps <= AHEAD_BEHIND_STEP_LIMIT; current = current->parent) {
+        if (current == older) {
+            return steps;
+        }
+        if (current->mergeParent != NULL) {
+            return -1;
+        }
+        *lowest = current;
+        steps++;
+    }
+    return -1;
+}
+
+// Moves a cached count to a new tip (or base) that adds k plain commits on top of the
+// old one. Those commits are all new to the other side unless the lowest of them is
+// already reachable from it. Returns 0 when a full count is needed instead.
+int advanceAheadBehind(graphNode* oldEnd, graphNode* newEnd, graphNode* otherEnd, int* count) {
+    graphNode* lowest = NULL;
+    int steps = linearStepsBetween(oldEnd, newEnd, &lowest);
+    if (steps < 0 || (steps > 0 && isAncestor(lowest, otherEnd))) {
+        return 0;
+    }
+    *count += steps;
+    return 1;
+}
+
+// Ahead/behind of a branch against base, reusing the count cached for the branch and
+// updating it incrementally when either tip has only gained plain commits
+void getAheadBehind(repository* repo, int branchIndex, graphNode* base, int* ahead, int* behind) {
+    aheadBehindEntry* entry = &repo->aheadBehind[branchIndex];
+    graphNode* tip = repo->nodes[branchIndex];
+    if (entry->valid && (entry->tip != tip || entry->base != base)) {
+        int updated = advanceAheadBehind(entry->tip, tip, entry->base, &entry->ahead);
+        if (updated) {
+            entry->tip = tip;
+            updated = advanceAheadBehind(entry->base, base, entry->tip, &entry->behind);
+        }
+        if (updated) {
+            entry->base = base;
+        } else {
+            entry->valid = 0;
+        }
+    }
+    if (!entry->valid) {
+        countAheadBehind(tip, base, &entry->ahead, &entry->behind);
+        entry->tip = tip;
+        entry->base = base;
+        entry->valid = 1;
+    }
+    *ahead = entry->ahead;
+    *behind = entry->behind;
+}
+
+void printAheadBehindVisitor(repository* repo, int refIndex, void* context) {
+    if (isTagRef(repo->branches[refIndex]) || repo->nodes[refIndex] == NULL) {
+        return;
+    }
+    int ahead;
+    int behind;
+    getAheadBehind(repo, refIndex, (graphNode*)context, &ahead, &behind);
+    printf("%-30s ahead %d, behind %d\n", repo->branches[refIndex], ahead, behind);
+}
+
+void printAheadBehind(repository* repo, const char* baseName) {
+    int baseIndex = findBranch(repo, baseName);
+    if (baseIndex == -1 || repo->nodes[baseIndex] == NULL) {
+        printf("Branch not found: %s\n", baseName);
+        return;
+    }
+    forEachRef(repo, "", printAheadBehindVisitor, repo->nodes[baseIndex]);
+}
+
+//-----------------MERGE-BASE CACHE-------------------------------------
+
+int mergeBaseSlot(int commitA, int commitB) {
+    return (int)(mixHash(((unsigned long long)(unsigned int)commitA << 32) | (unsigned int)commitB) % MERGE_BASE_BUCKETS);
+}
+
+void unlinkMergeBase(mergeBaseCache* cache, mergeBaseEntry* entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+void pushNewestMergeBase(mergeBaseCache* cache, mergeBaseEntry* entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    }
+    cache->newest = entry;
+    if (cache->oldest == NULL) {
+        cache->oldest = entry;
+    }
+}
+
+int isVirtualBase(const graphNode* node) {
+    return node != NULL && node->commit->fileID < -1;
+}
+
+void retainVirtualBase(graphNode* node) {
+    if (isVirtualBase(node)) {
+        node->references++;
+    }
+}
+
+// Drops one reference to a virtual merge base. The last one frees it, and with it the
+// references it held on its own (virtual) parents.
+void releaseVirtualBase(graphNode* node) {
+    while (isVirtualBase(node) && --node->references == 0) {
+        graphNode* parent = node->parent;
+        releaseVirtualBase(node->mergeParent);
+        if (node->tree != NULL) {
+            free(node->tree->entries);
+            free(node->tree);
+        }
+        free(node->commit);
+        free(node);
+        node = parent;
+    }
+}
+
+void evictOldestMergeBase(mergeBaseCache* cache) {
+    mergeBaseEntry* victim = cache->oldest;
+    unlinkMergeBase(cache, victim);
+    mergeBaseEntry** link = &cache->buckets[mergeBaseSlot(victim->commitA, victim->commitB)];
+    while (*link != victim) {
+        link = &(*link)->hashNext;
+    }
+    *link = victim->hashNext;
+    releaseVirtualBase(victim->base);
+    free(victim);
+    cache->count--;
+}
+
+void orderCommitPair(graphNode* commit1, graphNode* commit2, int* commitA, int* commitB) {
+    *commitA = commit1->commit->fileID;
+    *commitB = commit2->commit->fileID;
+    if (*commitA > *commitB) {
+        int swap = *commitA;
+        *commitA = *commitB;
+        *commitB = swap;
+    }
+}
+
+// Merge bases keyed by the unordered commit ID pair. Commits never change, so entries
+// are never invalidated; the least recently used one is dropped when the cache is full.
+int lookupMergeBase(mergeBaseCache* cache, graphNode* commit1, graphNode* commit2, graphNode** base) {
+    if (commit1 == NULL || commit2 == NULL) {
+        return 0;
+    }
+    int commitA;
+    int commitB;
+    orderCommitPair(commit1, commit2, &commitA, &commitB);
+    for (mergeBaseEntry* entry = cache->buckets[mergeBaseSlot(commitA, commitB)]; entry != NULL; entry = entry->hashNext) {
+        if (entry->commitA == commitA && entry->commitB == commitB) {
+            unlinkMergeBase(cache, entry);
+            pushNewestMergeBase(cache, entry);
+            cache->hits++;
+            *base = entry->base;
+            return 1;
+        }
+    }
+    cache->misses++;
+    return 0;
+}
+
+void storeMergeBase(mergeBaseCache* cache, graphNode* commit1, graphNode* commit2, graphNode* base) {
+    if (commit1 == NULL || commit2 == NULL) {
+        return;
+    }
+    int commitA;
+    int commitB;
+    orderCommitPair(commit1, commit2, &commitA, &commitB);
+    retainVirtualBase(base); // Before evicting, which may release the last other reference
+    if (cache->count == MERGE_BASE_CACHE_SIZE) {
+        evictOldestMergeBase(cache);
+    }
+    int slot = mergeBaseSlot(commitA, commitB);
+    mergeBaseEntry* entry = (mergeBaseEntry*)malloc(sizeof(mergeBaseEntry));
+    entry->commitA = commitA;
+    entry->commitB = commitB;
+    entry->base = base;
+    entry->hashNext = cache->buckets[slot];
+    cache->buckets[slot] = entry;
+    pushNewestMergeBase(cache, entry);
+    cache->count++;
+}
+
+char* getFileContent(int fileID, repository* repo) {
+    int hashIndex = fileID % N;
+    File* currentFile = repo->fileHash[hashIndex];
+    while (currentFile != NULL) {
+        if (currentFile->fileID == fileID) {
+            return currentFile->content;
+        }
+        currentFile = currentFile->next;
+    }
+    return "File not found";
+}
+
+//-----------------SNAPSHOTS--------------------------------------------
+
+snapshot emptySnapshot = {0, 0, NULL};
+
+snapshot* createSnapshot(int capacity) {
+    snapshot* tree = (snapshot*)malloc(sizeof(snapshot));
+    tree->count = 0;
+    tree->capacity = capacity > 0 ? capacity : 4;
+    tree->entries = (treeEntry*)malloc(tree->capacity * sizeof(treeEntry));
+    return tree;
+}
+
+snapshot* copySnapshot(const snapshot* source) {
+    snapshot* tree = createSnapshot(source->count + 1);
+    if (source->count > 0) {
+        memcpy(tree->entries, source->entries, source->count * sizeof(treeEntry));
+    }
+    tree->count = source->count;
+    return tree;
+}
+
+void freeSnapshot(snapshot* tree) {
+    if (tree != NULL && tree != &emptySnapshot) {
+        free(tree->entries);
+        free(tree);
+    }
+}
+
+// Returns the index of the first entry whose path is >= path
+int lowerBoundTreeEntry(const snapshot* tree, const char* path) {
+    int low = 0;
+    int high = tree->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(tree->entries[mid].path, path) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int findTreeEntry(const snapshot* tree, const char* path) {
+    int index = lowerBoundTreeEntry(tree, path);
+    if (index < tree->count && strcmp(tree->entries[index].path, path) == 0) {
+        return index;
+    }
+    return -1;
+}
+
+void setTreeEntry(snapshot* tree, const char* path, int fileID) {
+    int index = lowerBoundTreeEntry(tree, path);
+    if (index < tree->count && strcmp(tree->entries[index].path, path) == 0) {
+        tree->entries[index].fileID = fileID;
+        return;
+    }
+    if (tree->count == tree->capacity) {
+        tree->capacity *= 2;
+        tree->entries = (treeEntry*)realloc(tree->entries, tree->capacity * sizeof(treeEntry));
+    }
+    memmove(&tree->entries[index + 1], &tree->entries[index], (tree->count - index) * sizeof(treeEntry));
+    snprintf(tree->entries[index].path, sizeof(tree->entries[index].path), "%s", path);
+    tree->entries[index].fileID = fileID;
+    tree->count++;
+}
+
+void removeTreeEntry(snapshot* tree, const char* path) {
+    int index = findTreeEntry(tree, path);
+    if (index >= 0) {
+        memmove(&tree->entries[index], &tree->entries[index + 1], (tree->count - index - 1) * sizeof(treeEntry));
+        tree->count--;
+    }
+}
+
+// Builds the snapshot of a commit from the nearest cached ancestor along the first-parent chain
+snapshot* getSnapshot(graphNode* node) {
+    if (node == NULL) {
+        return &emptySnapshot;
+    }
+    if (node->tree != NULL) {
+        return node->tree;
+    }
+
+    int chainCount = 0;
+    int chainCapacity = 16;
+    graphNode** chain = (graphNode**)malloc(chainCapacity * sizeof(graphNode*));
+    graphNode* current = node;
+    while (current != NULL && current->tree == NULL) {
+        if (chainCount == chainCapacity) {
+            chainCapacity *= 2;
+            chain = (graphNode**)realloc(chain, chainCapacity * sizeof(graphNode*));
+        }
+        chain[chainCount++] = current;
+        current = current->parent;
+    }
+
+    snapshot* base = current != NULL ? current->tree : &emptySnapshot;
+    for (int i = chainCount - 1; i >= 0; i--) {
+        snapshot* tree = copySnapshot(base);
+        commit* c = chain[i]->commit;
+        if (c->fileID >= 0) {
+            setTreeEntry(tree, c->originalFileName, c->fileID);
+        }
+        chain[i]->tree = tree;
+        base = tree;
+    }
+
+    free(chain);
+    return node->tree;
+}
+
+//-----------------DIFF AND RENAME DETECTION----------------------------
+
+diffList* createDiffList() {
+    diffList* list = (diffList*)malloc(sizeof(diffList));
+    list->count = 0;
+    list->capacity = 8;
+    list->entries = (diffEntry*)malloc(list->capacity * sizeof(diffEntry));
+    return list;
+}
+
+void freeDiffList(diffList* list) {
+    if (list != NULL) {
+        free(list->entries);
+        free(list);
+    }
+}
+
+void addDiffEntry(diffList* list, char status, const char* oldPath, int oldFileID, const char* newPath, int newFileID) {
+    if (list->count == list->capacity) {
+        list->capacity *= 2;
+        list->entries = (diffEntry*)realloc(list->entries, list->capacity * sizeof(diffEntry));
+    }
+    diffEntry* entry = &list->entries[list->count++];
+    entry->status = status;
+    entry->score = 0;
+    snprintf(entry->oldPath, sizeof(entry->oldPath), "%s", oldPath != NULL ? oldPath : "");
+    snprintf(entry->newPath, sizeof(entry->newPath), "%s", newPath != NULL ? newPath : "");
+    entry->oldFileID = oldFileID;
+    entry->newFileID = newFileID;
+}
+
+// The hash only rules objects out: equal hashes are confirmed byte by byte
+int sameContent(const File* file1, const File* file2) {
+    return file1 != NULL && file2 != NULL && file1->size == file2->size && file1->contentHash == file2->contentHash &&
+           memcmp(file1->content, file2->content, file1->size) == 0;
+}
+
+int sameObject(repository* repo, int fileID1, int fileID2) {
+    if (fileID1 == fileID2) {
+        return 1;
+    }
+    return sameContent(findFile(fileID1, repo), findFile(fileID2, repo));
+}
+
+// MinHash sketch over the lines of a file; returns the number of lines seen
+int computeSketch(const File* file, unsigned long long sketch[SKETCH_SIZE]) {
+    for (int k = 0; k < SKETCH_SIZE; k++) {
+        sketch[k] = ULLONG_MAX;
+    }
+
+    int lineCount = 0;
+    if (file == NULL) {
+        return 0;
+    }
+    const char* line = file->content;
+    const char* contentEnd = file->content + file->size;
+    while (line < contentEnd) {
+        const char* end = memchr(line, '\n', contentEnd - line);
+        size_t length = end != NULL ? (size_t)(end - line) : (size_t)(contentEnd - line);
+        unsigned long long lineHash = hashBytes(line, length);
+        for (int k = 0; k < SKETCH_SIZE; k++) {
+            unsigned long long value = mixHash(lineHash ^ mixHash((unsigned long long)(k + 1)));
+            if (value < sketch[k]) {
+                sketch[k] = value;
+            }
+        }
+        lineCount++;
+        if (end == NULL) {
+            break;
+        }
+        line = end + 1;
+    }
+    return lineCount;
+}
+
+int sketchSimilarity(const unsigned long long* sketch1, const unsigned long long* sketch2) {
+    int matches = 0;
+    for (int k = 0; k < SKETCH_SIZE; k++) {
+        if (sketch1[k] == sketch2[k]) {
+            matches++;
+        }
+    }
+    return matches * 100 / SKETCH_SIZE;
+}
+
+unsigned long long bandKey(const unsigned long long* sketch, int band) {
+    int rows = SKETCH_SIZE / SKETCH_BANDS;
+    return hashBytes((const char*)&sketch[band * rows], rows * sizeof(unsigned long long)) ^ mixHash((unsigned long long)band);
+}
+
+int tableSizeFor(int count) {
+    int size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Turns matching D/A pairs into renames and A entries with a surviving source into copies.
+// Exact matches go through a content hash table, inexact ones through MinHash sketches
+// bucketed by LSH bands, so only files sharing a band are ever compared.
+void detectRenames(repository* repo, const snapshot* oldTree, diffList* diff) {
+    int sourceCount = oldTree->count;
+    if (sourceCount == 0) {
+        return;
+    }
+
+    int* deletedEntry = (int*)malloc(sourceCount * sizeof(int));
+    int* renamed = (int*)calloc(sourceCount, sizeof(int));
+    for (int i = 0; i < sourceCount; i++) {
+        deletedEntry[i] = -1;
+    }
+    for (int i = 0; i < diff->count; i++) {
+        if (diff->entries[i].status == 'D') {
+            deletedEntry[findTreeEntry(oldTree, diff->entries[i].oldPath)] = i;
+        }
+    }
+
+    // Exact pass: content hash -> chains of old tree entries, the deleted ones (rename
+    // sources) apart from the rest (copy sources). A deleted source leaves its chain once
+    // paired, so identical files never make later destinations walk past it again.
+    int exactSize = tableSizeFor(sourceCount);
+    int* deletedHead = (int*)malloc(exactSize * sizeof(int));
+    int* otherHead = (int*)malloc(exactSize * sizeof(int));
+    int* pairedHead = (int*)malloc(exactSize * sizeof(int)); // Last renamed source, still a copy source
+    int* exactNext = (int*)malloc(sourceCount * sizeof(int));
+    unsigned long long* sourceHash = (unsigned long long*)malloc(sourceCount * sizeof(unsigned long long));
+    for (int i = 0; i < exactSize; i++) {
+        deletedHead[i] = -1;
+        otherHead[i] = -1;
+        pairedHead[i] = -1;
+    }
+    for (int i = sourceCount - 1; i >= 0; i--) {
+        File* file = findFile(oldTree->entries[i].fileID, repo);
+        sourceHash[i] = file != NULL ? file->contentHash : 0;
+        int slot = (int)(mixHash(sourceHash[i]) & (exactSize - 1));
+        int* head = deletedEntry[i] >= 0 ? &deletedHead[slot] : &otherHead[slot];
+        exactNext[i] = *head;
+        *head = i;
+    }
+
+    for (int i = 0; i < diff->count; i++) {
+        diffEntry* entry = &diff->entries[i];
+        if (entry->status != 'A') {
+            continue;
+        }
+        File* file = findFile(entry->newFileID, repo);
+        if (file == NULL) {
+            continue;
+        }
+        int slot = (int)(mixHash(file->contentHash) & (exactSize - 1));
+        int best = -1;
+        int examined = 0;
+        for (int* link = &deletedHead[slot]; *link != -1 && examined < MAX_BUCKET_CANDIDATES; link = &exactNext[*link]) {
+            examined++;
+            int source = *link;
+            if (sourceHash[source] == file->contentHash && sameContent(findFile(oldTree->entries[source].fileID, repo), file)) {
+                best = source;
+                *link = exactNext[source];
+                pairedHead[slot] = source;
+                break;
+            }
+        }
+        int renamedFrom = best;
+        for (int source = otherHead[slot]; best == -1 && source != -1 && examined < MAX_BUCKET_CANDIDATES;
+             source = exactNext[source]) {
+            examined++;
+            if (sourceHash[source] == file->contentHash && sameContent(findFile(oldTree->entries[source].fileID, repo), file)) {
+                best = source;
+            }
+        }
+        int paired = pairedHead[slot];
+        if (best == -1 && paired != -1 && sourceHash[paired] == file->contentHash &&
+            sameContent(findFile(oldTree->entries[paired].fileID, repo), file)) {
+            best = paired;
+        }
+        if (best == -1) {
+            continue;
+        }
+        snprintf(entry->oldPath, sizeof(entry->oldPath), "%s", oldTree->entries[best].path);
+        entry->oldFileID = oldTree->entries[best].fileID;
+        entry->score = 100;
+        if (renamedFrom != -1) {
+            entry->status = 'R';
+            renamed[best] = 1;
+            diff->entries[deletedEntry[best]].status = 0;
+        } else {
+            entry->status = 'C';
+        }
+    }
+
+    // Inexact pass: sketch the remaining deleted and modified sources and the unmatched destinations
+    int* sources = (int*)malloc(sourceCount * sizeof(int));
+    int inexactCount = 0;
+    for (int i = 0; i < diff->count; i++) {
+        diffEntry* entry = &diff->entries[i];
+        if (entry->status == 'D' || entry->status == 'M') {
+            sources[inexactCount++] = findTreeEntry(oldTree, entry->oldPath);
+        }
+    }
+
+    int destinationCount = 0;
+    for (int i = 0; i < diff->count; i++) {
+        if (diff->entries[i].status == 'A') {
+            destinationCount++;
+        }
+    }
+
+    if (inexactCount > 0 && destinationCount > 0) {
+        unsigned long long (*sketches)[SKETCH_SIZE] = malloc(inexactCount * sizeof(*sketches));
+        int* usable = (int*)malloc(inexactCount * sizeof(int));
+        int bandSize = tableSizeFor(inexactCount * SKETCH_BANDS);
+        int* bandHead = (int*)malloc(bandSize * sizeof(int));
+        unsigned long long* bandKeys = (unsigned long long*)malloc(bandSize * sizeof(unsigned long long));
+        int* bandNext = (int*)malloc(inexactCount * SKETCH_BANDS * sizeof(int));
+        int* lastSeen = (int*)malloc(inexactCount * sizeof(int));
+        for (int i = 0; i < bandSize; i++) {
+            bandHead[i] = -1;
+        }
+
+        for (int j = 0; j < inexactCount; j++) {
+            lastSeen[j] = -1;
+            usable[j] = computeSketch(findFile(oldTree->entries[sources[j]].fileID, repo), sketches[j]) > 0;
+            if (!usable[j]) {
+                continue;
+            }
+            for (int b = 0; b < SKETCH_BANDS; b++) {
+                unsigned long long key = bandKey(sketches[j], b);
+                int slot = (int)(key & (bandSize - 1));
+                while (bandHead[slot] != -1 && bandKeys[slot] != key) {
+                    slot = (slot + 1) & (bandSize - 1);
+                }
+                bandKeys[slot] = key;
+                bandNext[j * SKETCH_BANDS + b] = bandHead[slot];
+                bandHead[slot] = j * SKETCH_BANDS + b;
+            }
+        }
+
+        for (int i = 0; i < diff->count; i++) {
+            diffEntry* entry = &diff->entries[i];
+            if (entry->status != 'A') {
+                continue;
+            }
+            unsigned long long sketch[SKETCH_SIZE];
+            if (computeSketch(findFile(entry->newFileID, repo), sketch) == 0) {
+                continue;
+            }
+
+            int best = -1;
+            int bestScore = -1;
+            for (int b = 0; b < SKETCH_BANDS; b++) {
+                unsigned long long key = bandKey(sketch, b);
+                int slot = (int)(key & (bandSize - 1));
+                while (bandHead[slot] != -1 && bandKeys[slot] != key) {
+                    slot = (slot + 1) & (bandSize - 1);
+                }
+                int examined = 0;
+                for (int link = bandHead[slot]; link != -1 && examined < MAX_BUCKET_CANDIDATES; link = bandNext[link]) {
+                    int j = link / SKETCH_BANDS;
+                    examined++;
+                    if (lastSeen[j] == i) {
+                        continue;
+                    }
+                    lastSeen[j] = i;
+                    int score = sketchSimilarity(sketch, sketches[j]);
+                    int s = sources[j];
+                    int freeRename = deletedEntry[s] >= 0 && !renamed[s];
+                    int bestFreeRename = best >= 0 && deletedEntry[sources[best]] >= 0 && !renamed[sources[best]];
+                    if (score > bestScore || (score == bestScore && freeRename && !bestFreeRename)) {
+                        best = j;
+                        bestScore = score;
+                    }
+                }
+            }
+
+            if (best == -1 || bestScore < RENAME_THRESHOLD) {
+                continue;
+            }
+            int s = sources[best];
+            snprintf(entry->oldPath, sizeof(entry->oldPath), "%s", oldTree->entries[s].path);
+            entry->oldFileID = oldTree->entries[s].fileID;
+            entry->score = bestScore;
+            if (deletedEntry[s] >= 0 && !renamed[s]) {
+                entry->status = 'R';
+                renamed[s] = 1;
+                diff->entries[deletedEntry[s]].status = 0;
+            } else {
+                entry->status = 'C';
+            }
+        }
+
+        free(sketches);
+        free(usable);
+        free(bandHead);
+        free(bandKeys);
+        free(bandNext);
+        free(lastSeen);
+    }
+
+    int kept = 0;
+    for (int i = 0; i < diff->count; i++) {
+        if (diff->entries[i].status != 0) {
+            diff->entries[kept++] = diff->entries[i];
+        }
+    }
+    diff->count = kept;
+
+    free(sources);
+    free(deletedHead);
+    free(otherHead);
+    free(pairedHead);
+    free(exactNext);
+    free(sourceHash);
+    free(deletedEntry);
+    free(renamed);
+}
+
+const char* diffEntryPath(const diffEntry* entry) {
+    return entry->status == 'D' ? entry->oldPath : entry->newPath;
+}
+
+int compareDiffEntries(const void* a, const void* b) {
+    return strcmp(diffEntryPath((const diffEntry*)a), diffEntryPath((const diffEntry*)b));
+}
+
+diffList* diffSnapshots(repository* repo, const snapshot* oldTree, const snapshot* newTree) {
+    diffList* diff = createDiffList();
+    int i = 0;
+    int j = 0;
+    while (i < oldTree->count || j < newTree->count) {
+        int order;
+        if (i == oldTree->count) {
+            order = 1;
+        } else if (j == newTree->count) {
+            order = -1;
+        } else {
+            order = strcmp(oldTree->entries[i].path, newTree->entries[j].path);
+        }
+
+        if (order < 0) {
+            addDiffEntry(diff, 'D', oldTree->entries[i].path, oldTree->entries[i].fileID, NULL, -1);
+            i++;
+        } else if (order > 0) {
+            addDiffEntry(diff, 'A', NULL, -1, newTree->entries[j].path, newTree->entries[j].fileID);
+            j++;
+        } else {
+            if (!sameObject(repo, oldTree->entries[i].fileID, newTree->entries[j].fileID)) {
+                addDiffEntry(diff, 'M', oldTree->entries[i].path, oldTree->entries[i].fileID,
+                             newTree->entries[j].path, newTree->entries[j].fileID);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    detectRenames(repo, oldTree, diff);
+    qsort(diff->entries, diff->count, sizeof(diffEntry), compareDiffEntries);
+    return diff;
+}
+
+diffList* diffCommits(repository* repo, graphNode* oldCommit, graphNode* newCommit) {
+    return diffSnapshots(repo, getSnapshot(oldCommit), getSnapshot(newCommit));
+}
+
+void printDiff(const diffList* diff) {
+    if (diff->count == 0) {
+        printf("No differences found.\n");
+        return;
+    }
+    for (int i = 0; i < diff->count; i++) {
+        const diffEntry* entry = &diff->entries[i];
+        if (entry->status == 'R' || entry->status == 'C') {
+            printf("%c%03d\t%s\t%s\n", entry->status, entry->score, entry->oldPath, entry->newPath);
+        } else {
+            printf("%c\t%s\n", entry->status, diffEntryPath(entry));
+        }
+    }
+}
+
+//-----------------LINE DIFF AND DIFFSTAT-------------------------------
+
+numstatCacheEntry numstatCache[NUMSTAT_CACHE_SIZE]; // Line counts keyed by (old, new) content hash
+pthread_mutex_t numstatCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+void freeLineTable(lineTable* lines) {
+    free(lines->hashes);
+    free(lines->starts);
+    free(lines->lengths);
+}
+
+// Hashes every line of a file; with spans the start and length of each line are kept too
+int splitLines(const File* file, lineTable* lines, int withSpans) {
+    lines->count = 0;
+    lines->hashes = NULL;
+    lines->starts = NULL;
+    lines->lengths = NULL;
+    if (file == NULL || file->size == 0) {
+        return 0;
+    }
+    int capacity = 64;
+    lines->hashes = (unsigned long long*)malloc(capacity * sizeof(unsigned long long));
+    if (withSpans) {
+        lines->starts = (const char**)malloc(capacity * sizeof(const char*));
+        lines->lengths = (int*)malloc(capacity * sizeof(int));
+    }
+    const char* line = file->content;
+    const char* contentEnd = file->content + file->size;
+    while (line < contentEnd) {
+        const char* end = memchr(line, '\n', contentEnd - line);
+        const char* next = end != NULL ? end + 1 : contentEnd;
+        if (lines->count == capacity) {
+            capacity *= 2;
+            lines->hashes = (unsigned long long*)realloc(lines->hashes, capacity * sizeof(unsigned long long));
+            if (withSpans) {
+                lines->starts = (const char**)realloc(lines->starts, capacity * sizeof(const char*));
+                lines->lengths = (int*)realloc(lines->lengths, capacity * sizeof(int));
+            }
+        }
+        lines->hashes[lines->count] = hashBytes(line, next - line);
+        if (withSpans) {
+            lines->starts[lines->count] = line;
+            lines->lengths[lines->count] = (int)(next - line);
+        }
+        lines->count++;
+        line = next;
+    }
+    return lines->count;
+}
+
+// Myers greedy forward pass; only the edit distance is needed so no trace is kept
+int lineEditDistance(const unsigned long long* a, int n, const unsigned long long* b, int m) {
+    int max = n + m;
+    if (max == 0) {
+        return 0;
+    }
+    int* v = (int*)malloc((2 * max + 3) * sizeof(int));
+    int offset = max + 1;
+    v[offset + 1] = 0;
+    for (int d = 0; d <= max; d++) {
+        for (int k = -d; k <= d; k += 2) {
+            int x;
+            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) {
+                x = v[offset + k + 1];
+            } else {
+                x = v[offset + k - 1] + 1;
+            }
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                free(v);
+                return d;
+            }
+        }
+    }
+    free(v);
+    return max;
+}
+
+// Counting mode of the diff core: added/removed line totals without building hunks.
+// Returns 0 for binary pairs, which have no line counts.
+int countLineChanges(const File* oldFile, const File* newFile, int* added, int* removed) {
+    if ((oldFile != NULL && isBinaryContent(oldFile->content, oldFile->size)) ||
+        (newFile != NULL && isBinaryContent(newFile->content, newFile->size))) {
+        *added = 0;
+        *removed = 0;
+        return 0;
+    }
+
+    unsigned long long oldKey = oldFile != NULL ? oldFile->contentHash : 0;
+    unsigned long long newKey = newFile != NULL ? newFile->contentHash : 0;
+    numstatCacheEntry* cached = &numstatCache[mixHash(oldKey ^ mixHash(newKey)) % NUMSTAT_CACHE_SIZE];
+    pthread_mutex_lock(&numstatCacheLock);
+    if (cached->valid && cached->oldHash == oldKey && cached->newHash == newKey &&
+        (cached->oldFile == oldFile || sameContent(cached->oldFile, oldFile)) &&
+        (cached->newFile == newFile || sameContent(cached->newFile, newFile))) {
+        *added = cached->added;
+        *removed = cached->removed;
+        pthread_mutex_unlock(&numstatCacheLock);
+        return 1;
+    }
+    pthread_mutex_unlock(&numstatCacheLock);
+
+    lineTable oldTable;
+    lineTable newTable;
+    int n = splitLines(oldFile, &oldTable, 0);
+    int m = splitLines(newFile, &newTable, 0);
+    unsigned long long* oldLines = oldTable.hashes;
+    unsigned long long* newLines = newTable.hashes;
+
+    int prefix = 0;
+    while (prefix < n && prefix < m && oldLines[prefix] == newLines[prefix]) {
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && oldLines[n - 1 - suffix] == newLines[m - 1 - suffix]) {
+        suffix++;
+    }
+
+    int oldCount = n - prefix - suffix;
+    int newCount = m - prefix - suffix;
+    int distance = lineEditDistance(oldLines + prefix, oldCount, newLines + prefix, newCount);
+    int common = (oldCount + newCount - distance) / 2;
+    *added = newCount - common;
+    *removed = oldCount - common;
+
+    freeLineTable(&oldTable);
+    freeLineTable(&newTable);
+
+    pthread_mutex_lock(&numstatCacheLock);
+    cached->valid = 1;
+    cached->oldHash = oldKey;
+    cached->newHash = newKey;
+    cached->oldFile = oldFile;
+    cached->newFile = newFile;
+    cached->added = *added;
+    cached->removed = *removed;
+    pthread_mutex_unlock(&numstatCacheLock);
+    return 1;
+}
+
+//-----------------WORKER POOL------------------------------------------
+
+typedef struct parallelRun {
+    int taskCount;
+    int nextTask;
+    int emitted;
+    char* done;
+    parallelTask task;
+    parallelTask emit;
+    void* context;
+    pthread_mutex_t lock;
+    pthread_cond_t taskDone;
+    pthread_cond_t slotFree;
+} parallelRun;
+
+int workerCount(int taskCount) {
+    int workers = 4;
+#ifdef _SC_NPROCESSORS_ONLN
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0) {
+        workers = (int)online;
+    }
+#endif
+    if (workers > MAX_WORKERS) {
+        workers = MAX_WORKERS;
+    }
+    return workers < taskCount ? workers : taskCount;
+}
+
+void* parallelWorker(void* argument) {
+    parallelRun* run = (parallelRun*)argument;
+    pthread_mutex_lock(&run->lock);
+    while (1) {
+        while (run->emit != NULL && run->nextTask < run->taskCount &&
+               run->nextTask >= run->emitted + REORDER_WINDOW) {
+            pthread_cond_wait(&run->slotFree, &run->lock);
+        }
+        if (run->nextTask >= run->taskCount) {
+            break;
+        }
+        int index = run->nextTask++;
+        pthread_mutex_unlock(&run->lock);
+
+        run->task(run->context, index);
+
+        pthread_mutex_lock(&run->lock);
+        run->done[index] = 1;
+        pthread_cond_broadcast(&run->taskDone);
+    }
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+// Runs task(context, i) for every index on a pool of threads. If emit is given it is
+// called on the calling thread in index order as results complete (a reorder buffer),
+// so output stays deterministic however the tasks were scheduled.
+void runParallelOrdered(int taskCount, parallelTask task, parallelTask emit, void* context) {
+    int workers = workerCount(taskCount);
+    if (workers <= 1) {
+        for (int i = 0; i < taskCount; i++) {
+            task(context, i);
+            if (emit != NULL) {
+                emit(context, i);
+            }
+        }
+        return;
+    }
+
+    parallelRun run;
+    run.taskCount = taskCount;
+    run.nextTask = 0;
+    run.emitted = 0;
+    run.done = (char*)calloc(taskCount, 1);
+    run.task = task;
+    run.emit = emit;
+    run.context = context;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.taskDone, NULL);
+    pthread_cond_init(&run.slotFree, NULL);
+
+    pthread_t threads[MAX_WORKERS];
+    for (int i = 0; i < workers; i++) {
+        pthread_create(&threads[i], NULL, parallelWorker, &run);
+    }
+
+    if (emit != NULL) {
+        for (int i = 0; i < taskCount; i++) {
+            pthread_mutex_lock(&run.lock);
+            while (!run.done[i]) {
+                pthread_cond_wait(&run.taskDone, &run.lock);
+            }
+            pthread_mutex_unlock(&run.lock);
+
+            emit(context, i);
+
+            pthread_mutex_lock(&run.lock);
+            run.emitted = i + 1;
+            pthread_cond_broadcast(&run.slotFree);
+            pthread_mutex_unlock(&run.lock);
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.taskDone);
+    pthread_cond_destroy(&run.slotFree);
+    free(run.done);
+}
+
+//-----------------PATCH OUTPUT-----------------------------------------
+
+void appendText(textBuffer* buffer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (buffer->size + needed + 1 > buffer->capacity) {
+        while (buffer->size + needed + 1 > buffer->capacity) {
+            buffer->capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 256;
+        }
+        buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+    }
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->size, needed + 1, format, args);
+    va_end(args);
+    buffer->size += needed;
+}
+
+// Myers diff with a per-step trace; returns for every old line the index of the matching
+// new line, or -1 when the line was removed
+int* matchLines(const lineTable* oldLines, const lineTable* newLines) {
+    int n = oldLines->count;
+    int m = newLines->count;
+    const unsigned long long* a = oldLines->hashes;
+    const unsigned long long* b = newLines->hashes;
+    int* match = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        match[i] = -1;
+    }
+
+    int prefix = 0;
+    while (prefix < n && prefix < m && a[prefix] == b[prefix]) {
+        match[prefix] = prefix;
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && a[n - 1 - suffix] == b[m - 1 - suffix]) {
+        match[n - 1 - suffix] = m - 1 - suffix;
+        suffix++;
+    }
+    a += prefix;
+    b += prefix;
+    n -= prefix + suffix;
+    m -= prefix + suffix;
+    if (n == 0 || m == 0) {
+        return match;
+    }
+
+    int max = n + m;
+    int offset = max + 1;
+    int* v = (int*)malloc((2 * max + 3) * sizeof(int));
+    int** trace = (int**)malloc((max + 1) * sizeof(int*));
+    int steps = 0;
+    v[offset + 1] = 0;
+    for (int d = 0; d <= max; d++) {
+        int found = 0;
+        for (int k = -d; k <= d; k += 2) {
+            int x;
+            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) {
+                x = v[offset + k + 1];
+            } else {
+                x = v[offset + k - 1] + 1;
+            }
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                found = 1;
+                break;
+            }
+        }
+        // Keep diagonals -d..d of this step for the backtrack
+        trace[d] = (int*)malloc((2 * d + 1) * sizeof(int));
+        memcpy(trace[d], &v[offset - d], (2 * d + 1) * sizeof(int));
+        steps = d + 1;
+        if (found) {
+            break;
+        }
+    }
+
+    int x = n;
+    int y = m;
+    for (int d = steps - 1; d > 0; d--) {
+        int* previous = trace[d - 1];
+        int k = x - y;
+        int previousK;
+        if (k == -d || (k != d && previous[k - 1 + d - 1] < previous[k + 1 + d - 1])) {
+            previousK = k + 1;
+        } else {
+            previousK = k - 1;
+        }
+        int previousX = previous[previousK + d - 1];
+        int previousY = previousX - previousK;
+        while (x > previousX && y > previousY) {
+            x--;
+            y--;
+            match[prefix + x] = prefix + y;
+        }
+        x = previousX;
+        y = previousY;
+    }
+    while (x > 0 && y > 0) {
+        x--;
+        y--;
+        match[prefix + x] = prefix + y;
+    }
+
+    for (int d = 0; d < steps; d++) {
+        free(trace[d]);
+    }
+    free(trace);
+    free(v);
+    return match;
+}
+
+void appendPatchLine(textBuffer* buffer, char marker, const lineTable* lines, int index) {
+    int length = lines->lengths[index];
+    const char* start = lines->starts[index];
+    if (length > 0 && start[length - 1] == '\n') {
+        appendText(buffer, "%c%.*s\n", marker, length - 1, start);
+    } else {
+        appendText(buffer, "%c%.*s\n\\ No newline at end of file\n", marker, length, start);
+    }
+}
+
+// Unified diff of one entry, rendered into a buffer so workers can build patches independently
+void formatFilePatch(repository* repo, const diffEntry* entry, textBuffer* buffer) {
+    const char* oldPath = entry->status == 'A' ? entry->newPath : entry->oldPath;
+    const char* newPath = entry->status == 'D' ? entry->oldPath : entry->newPath;
+    File* oldFile = entry->status == 'A' ? NULL : findFile(entry->oldFileID, repo);
+    File* newFile = entry->status == 'D' ? NULL : findFile(entry->newFileID, repo);
+
+    appendText(buffer, "diff --git a/%s b/%s\n", oldPath, newPath);
+    if (entry->status == 'A') {
+        appendText(buffer, "new file\n");
+    } else if (entry->status == 'D') {
+        appendText(buffer, "deleted file\n");
+    } else if (entry->status == 'R' || entry->status == 'C') {
+        appendText(buffer, "similarity index %d%%\n", entry->score);
+        appendText(buffer, "%s from %s\n", entry->status == 'R' ? "rename" : "copy", entry->oldPath);
+        appendText(buffer, "%s to %s\n", entry->status == 'R' ? "rename" : "copy", entry->newPath);
+    }
+
+    if ((oldFile != NULL && isBinaryContent(oldFile->content, oldFile->size)) ||
+        (newFile != NULL && isBinaryContent(newFile->content, newFile->size))) {
+        appendText(buffer, "Binary files a/%s and b/%s differ\n", oldPath, newPath);
+        return;
+    }
+
+    lineTable oldLines;
+    lineTable newLines;
+    splitLines(oldFile, &oldLines, 1);
+    splitLines(newFile, &newLines, 1);
+    int* match = matchLines(&oldLines, &newLines);
+
+    // Edit script: 0 = keep, -1 = remove old line, 1 = add new line
+    int scriptCapacity = oldLines.count + newLines.count + 1;
+    int* scriptOp = (int*)malloc(scriptCapacity * sizeof(int));
+    int* scriptOld = (int*)malloc(scriptCapacity * sizeof(int));
+    int* scriptNew = (int*)malloc(scriptCapacity * sizeof(int));
+    int scriptLength = 0;
+    int i = 0;
+    int j = 0;
+    while (i < oldLines.count || j < newLines.count) {
+        if (i < oldLines.count && match[i] == -1) {
+            scriptOp[scriptLength] = -1;
+            scriptOld[scriptLength] = i++;
+            scriptNew[scriptLength++] = j;
+        } else if (j < newLines.count && (i == oldLines.count || match[i] > j)) {
+            scriptOp[scriptLength] = 1;
+            scriptOld[scriptLength] = i;
+            scriptNew[scriptLength++] = j++;
+        } else {
+            scriptOp[scriptLength] = 0;
+            scriptOld[scriptLength] = i++;
+            scriptNew[scriptLength++] = j++;
+        }
+    }
+
+    int hasChanges = 0;
+    for (int s = 0; s < scriptLength && !hasChanges; s++) {
+        hasChanges = scriptOp[s] != 0;
+    }
+    if (hasChanges) {
+        appendText(buffer, "--- %s%s\n", oldFile != NULL ? "a/" : "", oldFile != NULL ? oldPath : "/dev/null");
+        appendText(buffer, "+++ %s%s\n", newFile != NULL ? "b/" : "", newFile != NULL ? newPath : "/dev/null");
+    }
+
+    int position = 0;
+    while (position < scriptLength) {
+        while (position < scriptLength && scriptOp[position] == 0) {
+            position++;
+        }
+        if (position == scriptLength) {
+            break;
+        }
+
+        int start = position - PATCH_CONTEXT_LINES < 0 ? 0 : position - PATCH_CONTEXT_LINES;
+        int end = position;
+        while (end < scriptLength) {
+            if (scriptOp[end] != 0) {
+                end++;
+                continue;
+            }
+            int run = end;
+            while (run < scriptLength && scriptOp[run] == 0) {
+                run++;
+            }
+            if (run == scriptLength || run - end > 2 * PATCH_CONTEXT_LINES) {
+                end = end + PATCH_CONTEXT_LINES < run ? end + PATCH_CONTEXT_LINES : run;
+                break;
+            }
+            end = run;
+        }
+
+        int oldCount = 0;
+        int newCount = 0;
+        for (int s = start; s < end; s++) {
+            oldCount += scriptOp[s] <= 0;
+            newCount += scriptOp[s] >= 0;
+        }
+        appendText(buffer, "@@ -%d,%d +%d,%d @@\n",
+                   oldCount > 0 ? scriptOld[start] + 1 : scriptOld[start], oldCount,
+                   newCount > 0 ? scriptNew[start] + 1 : scriptNew[start], newCount);
+        for (int s = start; s < end; s++) {
+            if (scriptOp[s] == 0) {
+                appendPatchLine(buffer, ' ', &oldLines, scriptOld[s]);
+            } else if (scriptOp[s] < 0) {
+                appendPatchLine(buffer, '-', &oldLines, scriptOld[s]);
+            } else {
+                appendPatchLine(buffer, '+', &newLines, scriptNew[s]);
+            }
+        }
+        position = end;
+    }
+
+    free(scriptOp);
+    free(scriptOld);
+    free(scriptNew);
+    free(match);
+    freeLineTable(&oldLines);
+    freeLineTable(&newLines);
+}
+
+typedef struct patchRun {
+    repository* repo;
+    const diffList* diff;
+    textBuffer* patches;
+} patchRun;
+
+void patchTask(void* context, int index) {
+    patchRun* run = (patchRun*)context;
+    formatFilePatch(run->repo, &run->diff->entries[index], &run->patches[index]);
+}
+
+void patchEmit(void* context, int index) {
+    patchRun* run = (patchRun*)context;
+    if (run->patches[index].size > 0) {
+        fwrite(run->patches[index].data, 1, run->patches[index].size, stdout);
+    }
+    free(run->patches[index].data);
+    run->patches[index].data = NULL;
+}
+
+// Per-file diffs are computed on the worker pool and printed in path order
+void printDiffPatch(repository* repo, const diffList* diff) {
+    if (diff->count == 0) {
+        printf("No differences found.\n");
+        return;
+    }
+    patchRun run;
+    run.repo = repo;
+    run.diff = diff;
+    run.patches = (textBuffer*)calloc(diff->count, sizeof(textBuffer));
+    runParallelOrdered(diff->count, patchTask, patchEmit, &run);
+    free(run.patches);
+}
+
+typedef struct statRun {
+    repository* repo;
+    const diffList* diff;
+    int* added;
+    int* removed;
+    int* text;
+} statRun;
+
+void statTask(void* context, int index) {
+    statRun* run = (statRun*)context;
+    const diffEntry* entry = &run->diff->entries[index];
+    File* oldFile = entry->status == 'A' ? NULL : findFile(entry->oldFileID, run->repo);
+    File* newFile = entry->status == 'D' ? NULL : findFile(entry->newFileID, run->repo);
+    run->text[index] = countLineChanges(oldFile, newFile, &run->added[index], &run->removed[index]);
+}
+
+void printDiffStat(repository* repo, const diffList* diff, int numstat) {
+    int* added = (int*)malloc((diff->count + 1) * sizeof(int));
+    int* removed = (int*)malloc((diff->count + 1) * sizeof(int));
+    int* text = (int*)malloc((diff->count + 1) * sizeof(int));
+    int totalAdded = 0;
+    int totalRemoved = 0;
+    int widest = 0;
+    int pathWidth = 0;
+
+    statRun run;
+    run.repo = repo;
+    run.diff = diff;
+    run.added = added;
+    run.removed = removed;
+    run.text = text;
+    runParallelOrdered(diff->count, statTask, NULL, &run);
+
+    for (int i = 0; i < diff->count; i++) {
+        const diffEntry* entry = &diff->entries[i];
+        totalAdded += added[i];
+        totalRemoved += removed[i];
+        if (added[i] + removed[i] > widest) {
+            widest = added[i] + removed[i];
+        }
+        int width = (int)strlen(diffEntryPath(entry));
+        if (entry->status == 'R' || entry->status == 'C') {
+            width += (int)strlen(entry->oldPath) + 4;
+        }
+        if (width > pathWidth) {
+            pathWidth = width;
+        }
+    }
+
+    for (int i = 0; i < diff->count; i++) {
+        const diffEntry* entry = &diff->entries[i];
+        char path[110];
+        if (entry->status == 'R' || entry->status == 'C') {
+            snprintf(path, sizeof(path), "%s => %s", entry->oldPath, entry->newPath);
+        } else {
+            snprintf(path, sizeof(path), "%s", diffEntryPath(entry));
+        }
+
+        if (numstat) {
+            if (text[i]) {
+                printf("%d\t%d\t%s\n", added[i], removed[i], path);
+            } else {
+                printf("-\t-\t%s\n", path);
+            }
+            continue;
+        }
+
+        if (!text[i]) {
+            printf(" %-*s | Bin\n", pathWidth, path);
+            continue;
+        }
+        int plus = added[i];
+        int minus = removed[i];
+        if (widest > DIFFSTAT_BAR_WIDTH) {
+            plus = (int)((long)plus * DIFFSTAT_BAR_WIDTH / widest);
+            minus = (int)((long)minus * DIFFSTAT_BAR_WIDTH / widest);
+        }
+        printf(" %-*s | %5d ", pathWidth, path, added[i] + removed[i]);
+        for (int j = 0; j < plus; j++) {
+            putchar('+');
+        }
+        for (int j = 0; j < minus; j++) {
+            putchar('-');
+        }
+        putchar('\n');
+    }
+
+    if (!numstat) {
+        printf(" %d file%s changed, %d insertion%s(+), %d deletion%s(-)\n",
+               diff->count, diff->count == 1 ? "" : "s",
+               totalAdded, totalAdded == 1 ? "" : "s",
+               totalRemoved, totalRemoved == 1 ? "" : "s");
+    }
+
+    free(added);
+    free(removed);
+    free(text);
+}
+
+//-----------------SPARSE CHECKOUT-------------------------------------
+
+sparseDirectory* findSparseDirectory(const sparseCone* cone, unsigned long long hash, const char* path, int length) {
+    if (cone->slotCount == 0) {
+        return NULL;
+    }
+    for (int slot = (int)(hash & (cone->slotCount - 1));; slot = (slot + 1) & (cone->slotCount - 1)) {
+        sparseDirectory* entry = &cone->slots[slot];
+        if (entry->path == NULL) {
+            return NULL;
+        }
+        if (entry->hash == hash && entry->length == length && memcmp(entry->path, path, length) == 0) {
+            return entry;
+        }
+    }
+}
+
+void addSparseDirectory(sparseCone* cone, const char* path, int length, int recursive) {
+    unsigned long long hash = hashBytes(path, length);
+    sparseDirectory* existing = findSparseDirectory(cone, hash, path, length);
+    if (existing != NULL) {
+        existing->recursive |= recursive;
+        return;
+    }
+    if (2 * (cone->count + 1) > cone->slotCount) {
+        sparseDirectory* oldSlots = cone->slots;
+        int oldSlotCount = cone->slotCount;
+        cone->slotCount = oldSlotCount > 0 ? oldSlotCount * 2 : 16;
+        cone->slots = (sparseDirectory*)calloc(cone->slotCount, sizeof(sparseDirectory));
+        for (int i = 0; i < oldSlotCount; i++) {
+            if (oldSlots[i].path != NULL) {
+                int slot = (int)(oldSlots[i].hash & (cone->slotCount - 1));
+                while (cone->slots[slot].path != NULL) {
+                    slot = (slot + 1) & (cone->slotCount - 1);
+                }
+                cone->slots[slot] = oldSlots[i];
+            }
+        }
+        free(oldSlots);
+    }
+    int slot = (int)(hash & (cone->slotCount - 1));
+    while (cone->slots[slot].path != NULL) {
+        slot = (slot + 1) & (cone->slotCount - 1);
+    }
+    sparseDirectory* entry = &cone->slots[slot];
+    entry->path = (char*)malloc(length + 1);
+    memcpy(entry->path, path, length);
+    entry->path[length] = '\0';
+    entry->length = length;
+    entry->recursive = recursive;
+    entry->hash = hash;
+    cone->count++;
+}
+
+void clearSparseCone(sparseCone* cone) {
+    for (int i = 0; i < cone->slotCount; i++) {
+        free(cone->slots[i].path);
+    }
+    free(cone->slots);
+    memset(cone, 0, sizeof(sparseCone));
+}
+
+// Adds a directory to the cone, and its ancestors as directories whose own files are included
+void addConePattern(sparseCone* cone, const char* directory) {
+    while (*directory == '/') {
+        directory++;
+    }
+    int length = (int)strlen(directory);
+    while (length > 0 && directory[length - 1] == '/') {
+        length--;
+    }
+    if (length == 0) {
+        return;
+    }
+    for (int i = 0; i < length; i++) {
+        if (directory[i] == '/') {
+            addSparseDirectory(cone, directory, i, 0);
+        }
+    }
+    addSparseDirectory(cone, directory, length, 1);
+}
+
+void loadSparseCheckout(repository* repo) {
+    if (repo->worktree->sparse.loaded) {
+        return;
+    }
+    repo->worktree->sparse.loaded = 1;
+    char path[WORKING_PATH_LENGTH];
+    FILE* file = fopen(worktreeFile(repo, SPARSE_CHECKOUT, "", path), "r");
+    if (file == NULL) {
+        return;
+    }
+    repo->worktree->sparse.enabled = 1;
+    char line[50];
+    while (fscanf(file, "%49s", line) == 1) {
+        addConePattern(&repo->worktree->sparse, line);
+    }
+    fclose(file);
+}
+
+// Whether checkout and status include path. Costs one table lookup per directory level:
+// the prefix hashes are extended as the path is scanned.
+int inSparseCheckout(repository* repo, const char* path) {
+    loadSparseCheckout(repo);
+    if (!repo->worktree->sparse.enabled) {
+        return 1;
+    }
+    unsigned long long hash = hashBytes("", 0);
+    const sparseDirectory* parent = NULL;
+    int scanned = 0;
+    for (const char* slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        int length = (int)(slash - path);
+        hash = hashMoreBytes(hash, path + scanned, length - scanned);
+        scanned = length;
+        parent = findSparseDirectory(&repo->worktree->sparse, hash, path, length);
+        if (parent == NULL) {
+            return 0; // Neither in the cone nor an ancestor of it, and neither is anything below
+        }
+        if (parent->recursive) {
+            return 1;
+        }
+    }
+    return 1; // A top-level file, or directly inside an ancestor of the cone
+}
+
+// The part of tree that sparse checkout includes: tree itself when sparse checkout is off.
+// Release with freeSparseView.
+const snapshot* sparseView(repository* repo, const snapshot* tree) {
+    loadSparseCheckout(repo);
+    if (!repo->worktree->sparse.enabled) {
+        return tree;
+    }
+    snapshot* view = createSnapshot(tree->count);
+    for (int i = 0; i < tree->count; i++) {
+        if (inSparseCheckout(repo, tree->entries[i].path)) {
+            view->entries[view->count++] = tree->entries[i];
+        }
+    }
+    return view;
+}
+
+void freeSparseView(const snapshot* view, const snapshot* tree) {
+    if (view != tree) {
+        freeSnapshot((snapshot*)view);
+    }
+}
+
+//-----------------WORKING TREE-----------------------------------------
+
+// The stat cache remembers, per working file, which object was last written there and
+// the size and mtime it had then. A file whose stat still matches is known to hold that
+// object without reading it.
+void loadStatCache(repository* repo) {
+    if (repo->worktree->workingStats.loaded) {
+        return;
+    }
+    repo->worktree->workingStats.loaded = 1;
+    char path[WORKING_PATH_LENGTH];
+    FILE* file = fopen(worktreeFile(repo, STAT_CACHE, "", path), "r");
+    if (file == NULL) {
+        return;
+    }
+    statEntry entry;
+    while (fscanf(file, "%d %lld %lld %49[^\n]\n", &entry.fileID, &entry.size, &entry.mtime, entry.path) == 4) {
+        if (repo->worktree->workingStats.count == repo->worktree->workingStats.capacity) {
+            repo->worktree->workingStats.capacity = repo->worktree->workingStats.capacity > 0 ? repo->worktree->workingStats.capacity * 2 : 64;
+            repo->worktree->workingStats.entries = (statEntry*)realloc(repo->worktree->workingStats.entries,
+                                                             repo->worktree->workingStats.capacity * sizeof(statEntry));
+        }
+        repo->worktree->workingStats.entries[repo->worktree->workingStats.count++] = entry;
+    }
+    fclose(file);
+}
+
+void saveStatCache(repository* repo) {
+    if (!repo->worktree->workingStats.dirty || !ensureRepoDirectory()) {
+        return;
+    }
+    char path[WORKING_PATH_LENGTH];
+    char temporary[WORKING_PATH_LENGTH];
+    worktreeFile(repo, STAT_CACHE, "", path);
+    FILE* file = fopen(worktreeFile(repo, STAT_CACHE, ".tmp", temporary), "w");
+    if (file == NULL) {
+        return;
+    }
+    // Drops the entries forgetStat left behind, keeping the rest in order
+    int kept = 0;
+    for (int i = 0; i < repo->worktree->workingStats.count; i++) {
+        statEntry* entry = &repo->worktree->workingStats.entries[i];
+        if (entry->fileID == -1) {
+            continue;
+        }
+        repo->worktree->workingStats.entries[kept++] = *entry;
+        fprintf(file, "%d %lld %lld %s\n", entry->fileID, entry->size, entry->mtime, entry->path);
+    }
+    repo->worktree->workingStats.count = kept;
+    fclose(file);
+    replaceFile(temporary, path);
+    repo->worktree->workingStats.dirty = 0;
+}
+
+// Index of the first entry whose path is >= path
+int lowerBoundStatEntry(const statCache* cache, const char* path) {
+    int low = 0;
+    int high = cache->count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (strcmp(cache->entries[middle].path, path) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+statEntry* findStatEntry(repository* repo, const char* path) {
+    loadStatCache(repo);
+    int index = lowerBoundStatEntry(&repo->worktree->workingStats, path);
+    if (index < repo->worktree->workingStats.count && strcmp(repo->worktree->workingStats.entries[index].path, path) == 0) {
+        return &repo->worktree->workingStats.entries[index];
+    }
+    return NULL;
+}
+
+int statWorkingFile(const char* path, long long* size, long long* mtime) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return 0;
+    }
+    *size = (long long)info.st_size;
+    *mtime = (long long)info.st_mtime;
+    return 1;
+}
+
+void setStatEntry(repository* repo, const char* path, int fileID, long long size, long long mtime) {
+    statEntry* entry = findStatEntry(repo, path);
+    if (entry == NULL) {
+        statCache* cache = &repo->worktree->workingStats;
+        if (cache->count == cache->capacity) {
+            cache->capacity = cache->capacity > 0 ? cache->capacity * 2 : 64;
+            cache->entries = (statEntry*)realloc(cache->entries, cache->capacity * sizeof(statEntry));
+        }
+        int index = lowerBoundStatEntry(cache, path);
+        memmove(&cache->entries[index + 1], &cache->entries[index], (cache->count - index) * sizeof(statEntry));
+        cache->count++;
+        entry = &cache->entries[index];
+        snprintf(entry->path, sizeof(entry->path), "%s", path);
+    }
+    entry->fileID = fileID;
+    entry->size = size;
+    // Written this second: a later edit could keep the same stat, so verify by content
+    entry->mtime = mtime >= (long long)time(NULL) ? -1 : mtime;
+    repo->worktree->workingStats.dirty = 1;
+}
+
+// Records that path now holds fileID, with its current stat
+void recordStat(repository* repo, const char* path, int fileID) {
+    long long size;
+    long long mtime;
+    if (!statWorkingFile(path, &size, &mtime)) {
+        size = -1;
+        mtime = -1;
+    }
+    setStatEntry(repo, path, fileID, size, mtime);
+}
+
+void forgetStat(repository* repo, const char* path) {
+    statEntry* entry = findStatEntry(repo, path);
+    if (entry != NULL) {
+        // Marked rather than removed so that forgetting many paths stays linear;
+        // saveStatCache compacts the cache
+        entry->fileID = -1;
+        repo->worktree->workingStats.dirty = 1;
+    }
+}
+
+// Whether the file at location holds object: answered from the cached stat entry
+// (which may be NULL) when the file's stat is unchanged, otherwise by comparing contents.
+// Leaves the file's stat in *size and *mtime; *verified is set when contents were read.
+int fileHoldsObject(const statEntry* entry, const char* location, const File* object, long long* size,
+                    long long* mtime, int* verified) {
+    *verified = 0;
+    if (object == NULL || !statWorkingFile(location, size, mtime)) {
+        return 0;
+    }
+    if (entry != NULL && entry->fileID == object->fileID && entry->size == *size && entry->mtime == *mtime &&
+        entry->mtime != -1) {
+        return 1;
+    }
+    if ((long long)object->size != *size) {
+        return 0;
+    }
+    size_t length;
+    char* content = readWholeFile(location, &length);
+    int matches = content != NULL && length == object->size && memcmp(content, object->content, length) == 0;
+    free(content);
+    *verified = matches;
+    return matches;
+}
+
+// fileHoldsObject against the repository's stat cache, refreshing the entry when the
+// contents had to be compared
+int workingFileMatches(repository* repo, const char* path, int fileID) {
+    long long size;
+    long long mtime;
+    int verified;
+    char location[WORKING_PATH_LENGTH];
+    int matches = fileHoldsObject(findStatEntry(repo, path), workingPath(repo, path, location), findFile(fileID, repo),
+                                  &size, &mtime, &verified);
+    if (verified) {
+        setStatEntry(repo, path, fileID, size, mtime);
+    }
+    return matches;
+}
+
+typedef struct checkoutJob {
+    const char* path;
+    char location[WORKING_PATH_LENGTH]; // The path in the active worktree
+    const File* file;
+    statEntry cached; // Stat cache entry for the path, if hasCached
+    int hasCached;
+    int skipped; // The file already held the object
+    int failed;
+    int refresh; // The stat cache entry needs updating
+    long long size;
+    long long mtime;
+} checkoutJob;
+
+// Runs on the worker pool: only touches its own path and job
+void checkoutTask(void* context, int index) {
+    checkoutJob* job = &((checkoutJob*)context)[index];
+    int verified;
+    job->failed = 0;
+    job->skipped = fileHoldsObject(job->hasCached ? &job->cached : NULL, job->location, job->file, &job->size,
+                                   &job->mtime, &verified);
+    job->refresh = verified;
+    if (job->skipped) {
+        return;
+    }
+    job->refresh = 1;
+    if (job->file == NULL || !writeWholeFile(job->location, job->file->content, job->file->size) ||
+        !statWorkingFile(job->location, &job->size, &job->mtime)) {
+        job->failed = 1;
+    }
+}
+
+int compareStrings(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Creates the directories the given paths need, each once and parents first: a parent
+// directory sorts before everything inside it
+void createCheckoutDirectories(checkoutJob* jobs, int jobCount) {
+    int count = 0;
+    int capacity = 16;
+    char** directories = (char**)malloc(capacity * sizeof(char*));
+    for (int i = 0; i < jobCount; i++) {
+        const char* location = jobs[i].location;
+        for (const char* slash = strchr(location, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+            if (count == capacity) {
+                capacity *= 2;
+                directories = (char**)realloc(directories, capacity * sizeof(char*));
+            }
+            directories[count] = (char*)malloc(slash - location + 1);
+            memcpy(directories[count], location, slash - location);
+            directories[count][slash - location] = '\0';
+            count++;
+        }
+    }
+    qsort(directories, count, sizeof(char*), compareStrings);
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || strcmp(directories[i], directories[i - 1]) != 0) {
+            makeDirectory(directories[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(directories[i]);
+    }
+    free(directories);
+}
+
+// Writes the paths that differ between two snapshots into the working directory.
+// Removals and directory creation happen first on this thread; the files are then
+// checked and written by the worker pool, skipping those that already hold the target
+// object, and the stat cache is updated in path order afterwards.
+void writeTreeChanges(repository* repo, const snapshot* fromTree, const snapshot* toTree) {
+    int jobCount = 0;
+    checkoutJob* jobs = (checkoutJob*)malloc((toTree->count + 1) * sizeof(checkoutJob));
+    int i = 0;
+    int j = 0;
+    while (i < fromTree->count || j < toTree->count) {
+        int order;
+        if (i == fromTree->count) {
+            order = 1;
+        } else if (j == toTree->count) {
+            order = -1;
+        } else {
+            order = strcmp(fromTree->entries[i].path, toTree->entries[j].path);
+        }
+
+        if (order < 0) {
+            char buffer[WORKING_PATH_LENGTH];
+            const char* location = workingPath(repo, fromTree->entries[i].path, buffer);
+            remove(location);
+            removeEmptyParents(location, (int)strlen(repo->worktree->root));
+            forgetStat(repo, fromTree->entries[i].path);
+            i++;
+            continue;
+        }
+        const treeEntry* target = &toTree->entries[j];
+        if (order == 0) {
+            i++;
+        }
+        j++;
+        if (order == 0 && fromTree->entries[i - 1].fileID == target->fileID) {
+            continue;
+        }
+        checkoutJob* job = &jobs[jobCount++];
+        job->path = target->path;
+        snprintf(job->location, sizeof(job->location), "%s%s", repo->worktree->root, target->path);
+        job->file = findFile(target->fileID, repo);
+        statEntry* cached = findStatEntry(repo, target->path);
+        job->hasCached = cached != NULL;
+        if (cached != NULL) {
+            job->cached = *cached;
+        }
+    }
+
+    createCheckoutDirectories(jobs, jobCount);
+    runParallelOrdered(jobCount, checkoutTask, NULL, jobs);
+
+    for (int k = 0; k < jobCount; k++) {
+        checkoutJob* job = &jobs[k];
+        if (job->failed) {
+            printf("Error: Unable to write file %s.\n", job->path);
+        } else if (job->refresh) {
+            setStatEntry(repo, job->path, job->file->fileID, job->size, job->mtime);
+        }
+    }
+    free(jobs);
+    saveStatCache(repo);
+}
+
+// Paths that checkout would overwrite or delete although their working copy no longer
+// holds what the current snapshot says (local modifications)
+int findCheckoutConflicts(repository* repo, const snapshot* fromTree, const snapshot* toTree) {
+    int conflicts = 0;
+    int i = 0;
+    int j = 0;
+    while (i < fromTree->count || j < toTree->count) {
+        int order;
+        if (i == fromTree->count) {
+            order = 1;
+        } else if (j == toTree->count) {
+            order = -1;
+        } else {
+            order = strcmp(fromTree->entries[i].path, toTree->entries[j].path);
+        }
+
+        const char* path = order <= 0 ? fromTree->entries[i].path : toTree->entries[j].path;
+        int currentID = order <= 0 ? fromTree->entries[i].fileID : -1;
+        int targetID = order >= 0 ? toTree->entries[j].fileID : -1;
+        i += order <= 0;
+        j += order >= 0;
+        if (currentID == targetID) {
+            continue;
+        }
+
+        long long size;
+        long long mtime;
+        char location[WORKING_PATH_LENGTH];
+        int present = statWorkingFile(workingPath(repo, path, location), &size, &mtime);
+        int clean = currentID != -1 ? !present || workingFileMatches(repo, path, currentID)
+                                    : !present || workingFileMatches(repo, path, targetID);
+        if (!clean) {
+            printf("Error: Your local changes to %s would be overwritten by checkout.\n", path);
+            conflicts++;
+        }
+    }
+    return conflicts;
+}
+
+// Moves the active worktree's files from fromTree to toTree (within its sparse checkout).
+// Writes nothing and returns 0 when that would overwrite local modifications or
+// untracked files; every command that rewrites the working directory goes through here.
+int updateWorkingTree(repository* repo, const snapshot* fromTree, const snapshot* toTree) {
+    const snapshot* fromView = sparseView(repo, fromTree);
+    const snapshot* toView = sparseView(repo, toTree);
+    int clean = findCheckoutConflicts(repo, fromView, toView) == 0;
+    if (clean) {
+        writeTreeChanges(repo, fromView, toView);
+    }
+    freeSparseView(fromView, fromTree);
+    freeSparseView(toView, toTree);
+    return clean;
+}
+
+// Whether the tracked files of tree (within the sparse checkout) are unmodified in the
+// active worktree, printing the ones that are not
+int workingTreeClean(repository* repo, const snapshot* tree) {
+    const snapshot* view = sparseView(repo, tree);
+    int clean = findCheckoutConflicts(repo, view, &emptySnapshot) == 0;
+    freeSparseView(view, tree);
+    return clean;
+}
+
+// Whether node is the tip of the active worktree's current branch
+int isCurrentTip(repository* repo, graphNode* node) {
+    return repo->worktree->currentBranchIndex >= 0 && repo->nodes[repo->worktree->currentBranchIndex] == node;
+}
+
+// Switches branches and updates the working directory: only paths whose object differs
+// between the two snapshots are touched, and local modifications abort the checkout
+void checkoutBranch(repository* repo, const char* branchName) {
+    int branchIndex = findBranch(repo, branchName);
+    if (branchIndex == -1 || isTagRef(branchName)) {
+        printf("Branch not found: %s\n", branchName);
+        return;
+    }
+
+    worktree* holder = worktreeOnBranch(repo, branchIndex);
+    if (holder != NULL && holder != repo->worktree) {
+        printf("Error: Branch '%s' is checked out in worktree '%s'.\n", branchName, worktreeName(repo, holder));
+        return;
+    }
+
+    if (!updateWorkingTree(repo, getSnapshot(repo->nodes[repo->worktree->currentBranchIndex]),
+                           getSnapshot(repo->nodes[branchIndex]))) {
+        printf("Checkout aborted.\n");
+        return;
+    }
+    repo->worktree->currentBranchIndex = branchIndex;
+    printf("Switched to branch: %s\n", branchName);
+}
+
+// Replaces the sparse checkout directories (none: check out everything) and updates the
+// working directory to match; local modifications to paths leaving the cone abort it
+void setSparseCheckout(repository* repo, char** directories, int directoryCount) {
+    loadSparseCheckout(repo);
+    const snapshot* tree = getSnapshot(repo->nodes[repo->worktree->currentBranchIndex]);
+    const snapshot* oldView = sparseView(repo, tree);
+    sparseCone oldCone = repo->worktree->sparse;
+
+    memset(&repo->worktree->sparse, 0, sizeof(sparseCone));
+    repo->worktree->sparse.loaded = 1;
+    repo->worktree->sparse.enabled = directoryCount > 0;
+    for (int i = 0; i < directoryCount; i++) {
+        addConePattern(&repo->worktree->sparse, directories[i]);
+    }
+    const snapshot* newView = sparseView(repo, tree);
+
+    if (findCheckoutConflicts(repo, oldView, newView) > 0) {
+        printf("Sparse checkout not updated.\n");
+        clearSparseCone(&repo->worktree->sparse);
+        repo->worktree->sparse = oldCone;
+    } else {
+        writeTreeChanges(repo, oldView, newView);
+        clearSparseCone(&oldCone);
+        char path[WORKING_PATH_LENGTH];
+        char temporary[WORKING_PATH_LENGTH];
+        worktreeFile(repo, SPARSE_CHECKOUT, "", path);
+        if (!repo->worktree->sparse.enabled) {
+            remove(path);
+        } else if (ensureRepoDirectory()) {
+            FILE* file = fopen(worktreeFile(repo, SPARSE_CHECKOUT, ".tmp", temporary), "w");
+            if (file != NULL) {
+                for (int i = 0; i < directoryCount; i++) {
+                    fprintf(file, "%s\n", directories[i]);
+                }
+                fclose(file);
+                replaceFile(temporary, path);
+            }
+        }
+        printf("Checked out %d of %d file(s).\n", newView->count, tree->count);
+    }
+    freeSparseView(oldView, tree);
+    freeSparseView(newView, tree);
+}
+
+// Lists the tracked files of the current branch, within the sparse checkout, that were
+// modified or deleted in the working directory
+void printStatus(repository* repo) {
+    const snapshot* tree = getSnapshot(repo->nodes[repo->worktree->currentBranchIndex]);
+    const snapshot* view = sparseView(repo, tree);
+    int changes = 0;
+    for (int i = 0; i < view->count; i++) {
+        long long size;
+        long long mtime;
+        const char* path = view->entries[i].path;
+        char location[WORKING_PATH_LENGTH];
+        if (!statWorkingFile(workingPath(repo, path, location), &size, &mtime)) {
+            printf("deleted:  %s\n", path);
+            changes++;
+        } else if (!workingFileMatches(repo, path, view->entries[i].fileID)) {
+            printf("modified: %s\n", path);
+            changes++;
+        }
+    }
+    if (changes == 0) {
+        printf("Working directory clean.\n");
+    }
+    if (view->count < tree->count) {
+        printf("Sparse checkout: %d of %d file(s) present.\n", view->count, tree->count);
+    }
+    freeSparseView(view, tree);
+    saveStatCache(repo);
+}
+
+//-----------------WORKTREES--------------------------------------------
+
+worktree* findWorktree(repository* repo, const char* name) {
+    if (strcmp(name, "main") == 0) {
+        return repo->worktrees;
+    }
+    for (worktree* tree = repo->worktrees->next; tree != NULL; tree = tree->next) {
+        if (strcmp(tree->name, name) == 0) {
+            return tree;
+        }
+    }
+    return NULL;
+}
+
+// Adds a checkout of branchName in directory path. It gets its own current branch, stat
+// cache and sparse patterns, but commits, files and branches stay shared with the
+// repository, so nothing is copied beyond the working files themselves.
+worktree* addWorktree(repository* repo, const char* name, const char* path, const char* branchName) {
+    size_t pathLength = strlen(path);
+    while (pathLength > 0 && path[pathLength - 1] == '/') {
+        pathLength--;
+    }
+    // The name becomes a single directory under WORKTREES_DIR: no separators, and no
+    // leading '.', which also rules out "." and ".."
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL || hasInvalidRefCharacter(name) ||
+        strlen(name) >= MAX_BRANCH_NAME_LENGTH || findWorktree(repo, name) != NULL) {
+        printf("Error: Invalid or existing worktree name '%s'.\n", name);
+        return NULL;
+    }
+    if (pathLength == 0 || pathLength + 2 > REF_PATH_LENGTH) {
+        printf("Error: Invalid worktree path '%s'.\n", path);
+        return NULL;
+    }
+    int branchIndex = findBranch(repo, branchName);
+    if (branchIndex == -1 || isTagRef(branchName)) {
+        printf("Branch not found: %s\n", branchName);
+        return NULL;
+    }
+    worktree* holder = worktreeOnBranch(repo, branchIndex);
+    if (holder != NULL) {
+        printf("Error: Branch '%s' is checked out in worktree '%s'.\n", branchName, worktreeName(repo, holder));
+        return NULL;
+    }
+
+    char root[REF_PATH_LENGTH];
+    snprintf(root, sizeof(root), "%.*s/", (int)pathLength, path);
+    char metadata[WORKING_PATH_LENGTH];
+    snprintf(metadata, sizeof(metadata), "%s/%s", WORKTREES_DIR, name);
+    makeParentDirectories(root);
+    struct stat info;
+    if (stat(root, &info) != 0 || !S_ISDIR(info.st_mode) || !ensureRepoDirectory()) {
+        printf("Error: Unable to create worktree directory %s.\n", path);
+        return NULL;
+    }
+    makeDirectory(WORKTREES_DIR);
+    makeDirectory(metadata);
+
+    worktree* tree = createWorktree(name, root, branchIndex);
+    worktree* last = repo->worktrees;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    last->next = tree;
+
+    worktree* active = repo->worktree;
+    repo->worktree = tree;
+    remove(worktreeFile(repo, STAT_CACHE, "", metadata)); // Left by an earlier worktree of the same name
+    remove(worktreeFile(repo, SPARSE_CHECKOUT, "", metadata));
+    writeTreeChanges(repo, &emptySnapshot, getSnapshot(repo->nodes[branchIndex]));
+    repo->worktree = active;
+    printf("Worktree '%s' at %s checked out branch %s.\n", name, path, branchName);
+    return tree;
+}
+
+// Makes the commands that use a current branch or the working directory act on another worktree
+void switchWorktree(repository* repo, const char* name) {
+    worktree* tree = findWorktree(repo, name);
+    if (tree == NULL) {
+        printf("Worktree not found: %s\n", name);
+        return;
+    }
+    repo->worktree = tree;
+    printf("Switched to worktree '%s' (branch %s).\n", name, repo->branches[tree->currentBranchIndex]);
+}
+
+void listWorktrees(repository* repo) {
+    for (worktree* tree = repo->worktrees; tree != NULL; tree = tree->next) {
+        printf("%c %-20s %-30s %s\n", tree == repo->worktree ? '*' : ' ', worktreeName(repo, tree),
+               tree->root[0] != '\0' ? tree->root : ".", repo->branches[tree->currentBranchIndex]);
+    }
+}
+
+// Deletes a linked worktree's working files and metadata; local modifications abort it
+void removeWorktree(repository* repo, const char* name) {
+    worktree* tree = findWorktree(repo, name);
+    if (tree == NULL || tree == repo->worktrees || tree == repo->worktree) {
+        printf("Error: Cannot remove worktree '%s'.\n", name);
+        return;
+    }
+
+    worktree* active = repo->worktree;
+    repo->worktree = tree;
+    const snapshot* snapshotTree = getSnapshot(repo->nodes[tree->currentBranchIndex]);
+    const snapshot* view = sparseView(repo, snapshotTree);
+    int removed = findCheckoutConflicts(repo, view, &emptySnapshot) == 0;
+    if (removed) {
+        writeTreeChanges(repo, view, &emptySnapshot);
+        char path[WORKING_PATH_LENGTH];
+        remove(worktreeFile(repo, STAT_CACHE, "", path));
+        remove(worktreeFile(repo, SPARSE_CHECKOUT, "", path));
+        removeEmptyParents(worktreeFile(repo, STAT_CACHE, "", path), (int)strlen(WORKTREES_DIR) + 1);
+        removeEmptyParents(tree->root, (int)strlen(tree->root) - 1); // Just the root itself, when empty
+    }
+    freeSparseView(view, snapshotTree);
+    repo->worktree = active;
+    if (!removed) {
+        printf("Worktree '%s' not removed.\n", name);
+        return;
+    }
+
+    worktree* previous = repo->worktrees;
+    while (previous->next != tree) {
+        previous = previous->next;
+    }
+    previous->next = tree->next;
+    clearSparseCone(&tree->sparse);
+    free(tree->workingStats.entries);
+    freeSnapshot(tree->pendingResolutions);
+    clearPendingMerge(tree);
+    free(tree);
+    printf("Removed worktree '%s'.\n", name);
+}
+
+//-----------------THREE-WAY MERGE--------------------------------------
+
+void appendBytes(textBuffer* buffer, const char* data, size_t length) {
+    if (buffer->size + length + 1 > buffer->capacity) {
+        while (buffer->size + length + 1 > buffer->capacity) {
+            buffer->capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 256;
+        }
+        buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    buffer->data[buffer->size] = '\0';
+}
+
+void appendLineRange(textBuffer* buffer, const lineTable* lines, int from, int to) {
+    for (int i = from; i < to; i++) {
+        appendBytes(buffer, lines->starts[i], lines->lengths[i]);
+    }
+}
+
+void appendConflictMarker(textBuffer* buffer, const char* marker) {
+    if (buffer->size > 0 && buffer->data[buffer->size - 1] != '\n') {
+        appendBytes(buffer, "\n", 1);
+    }
+    appendText(buffer, "%s\n", marker);
+}
+
+int sameLineRange(const lineTable* a, int aFrom, int aTo, const lineTable* b, int bFrom, int bTo) {
+    if (aTo - aFrom != bTo - bFrom) {
+        return 0;
+    }
+    for (int i = 0; i < aTo - aFrom; i++) {
+        if (a->hashes[aFrom + i] != b->hashes[bFrom + i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//-----------------RECORDED RESOLUTIONS (RERERE)------------------------
+
+rerereEntry* rerereTable[RERERE_BUCKETS]; // Conflict key -> recorded resolution
+int rerereLoaded = 0;
+pthread_mutex_t rerereLock = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned long long foldLineHash(unsigned long long hash, unsigned long long lineHash) {
+    return mixHash(hash ^ lineHash) + 0x9e3779b97f4a7c15ULL;
+}
+
+unsigned long long hashLineRange(const lineTable* lines, int from, int to) {
+    unsigned long long hash = 0;
+    for (int i = from; i < to; i++) {
+        hash = foldLineHash(hash, lines->hashes[i]);
+    }
+    return hash;
+}
+
+unsigned long long hashTextLines(const char* data, size_t length) {
+    unsigned long long hash = 0;
+    const char* line = data;
+    const char* end = data + length;
+    while (line < end) {
+        const char* newline = memchr(line, '\n', end - line);
+        const char* next = newline != NULL ? newline + 1 : end;
+        hash = foldLineHash(hash, hashBytes(line, next - line));
+        line = next;
+    }
+    return hash;
+}
+
+// A conflict is identified by its two sides only, in either order, so the same clash
+// matches again whichever branch is merged into which and whatever the base was
+unsigned long long conflictKey(unsigned long long ourHash, unsigned long long theirHash) {
+    unsigned long long low = ourHash < theirHash ? ourHash : theirHash;
+    unsigned long long high = ourHash < theirHash ? theirHash : ourHash;
+    return mixHash(low ^ mixHash(high));
+}
+
+void storeResolutionInTable(unsigned long long key, const char* data, size_t length) {
+    int slot = (int)(key % RERERE_BUCKETS);
+    rerereEntry* entry = rerereTable[slot];
+    while (entry != NULL && entry->key != key) {
+        entry = entry->next;
+    }
+    if (entry == NULL) {
+        entry = (rerereEntry*)malloc(sizeof(rerereEntry));
+        entry->key = key;
+        entry->next = rerereTable[slot];
+        rerereTable[slot] = entry;
+    } else {
+        free(entry->resolution);
+    }
+    entry->resolution = (char*)malloc(length + 1);
+    memcpy(entry->resolution, data, length);
+    entry->resolution[length] = '\0';
+    entry->length = length;
+}
+
+// The database is an append-only file of "<key> <length>\n<resolution>\n" records;
+// later records for a key replace earlier ones
+void loadRerereDatabase() {
+    if (rerereLoaded) {
+        return;
+    }
+    rerereLoaded = 1;
+    size_t size;
+    char* data = readWholeFile(RERERE_DATABASE, &size);
+    if (data == NULL) {
+        return;
+    }
+    size_t position = 0;
+    while (position < size) {
+        unsigned long long key;
+        size_t length;
+        int consumed;
+        char header[64];
+        size_t headerLength = 0;
+        while (position + headerLength < size && data[position + headerLength] != '\n' && headerLength < sizeof(header) - 1) {
+            header[headerLength] = data[position + headerLength];
+            headerLength++;
+        }
+        header[headerLength] = '\0';
+        if (sscanf(header, "%llx %zu%n", &key, &length, &consumed) != 2 ||
+            position + headerLength + 1 + length + 1 > size) {
+            break;
+        }
+        position += headerLength + 1;
+        storeResolutionInTable(key, data + position, length);
+        position += length + 1;
+    }
+    free(data);
+}
+
+int findRecordedResolution(unsigned long long key, textBuffer* result) {
+    int found = 0;
+    pthread_mutex_lock(&rerereLock);
+    loadRerereDatabase();
+    for (rerereEntry* entry = rerereTable[key % RERERE_BUCKETS]; entry != NULL; entry = entry->next) {
+        if (entry->key == key) {
+            appendBytes(result, entry->resolution, entry->length);
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rerereLock);
+    return found;
+}
+
+int recordResolution(unsigned long long key, const char* data, size_t length) {
+    pthread_mutex_lock(&rerereLock);
+    loadRerereDatabase();
+    int saved = 0;
+    if (ensureRepoDirectory()) {
+        FILE* database = fopen(RERERE_DATABASE, "ab");
+        if (database != NULL) {
+            fprintf(database, "%016llx %zu\n", key, length);
+            fwrite(data, 1, length, database);
+            fputc('\n', database);
+            fclose(database);
+            storeResolutionInTable(key, data, length);
+            saved = 1;
+        }
+    }
+    pthread_mutex_unlock(&rerereLock);
+    return saved;
+}
+
+const char* findText(const char* haystack, size_t haystackLength, const char* needle, size_t needleLength) {
+    if (needleLength == 0) {
+        return haystack;
+    }
+    for (size_t i = 0; i + needleLength <= haystackLength; i++) {
+        if (haystack[i] == needle[0] && memcmp(haystack + i, needle, needleLength) == 0) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+int isMarkerLine(const char* line, size_t length, const char* marker) {
+    size_t markerLength = strlen(marker);
+    return length >= markerLength && memcmp(line, marker, markerLength) == 0;
+}
+
+// Splits a conflicted file (as written by mergeFileContents) into the text around the
+// conflicts and finds each conflict's replacement in the resolved file by locating that
+// surrounding text in order. Returns the number of resolutions recorded.
+int recordFileResolutions(const char* conflicted, size_t conflictedSize, const char* resolved, size_t resolvedSize) {
+    int capacity = 8;
+    int hunkCount = 0;
+    const char** contextStart = (const char**)malloc((capacity + 1) * sizeof(const char*));
+    size_t* contextLength = (size_t*)malloc((capacity + 1) * sizeof(size_t));
+    unsigned long long* keys = (unsigned long long*)malloc(capacity * sizeof(unsigned long long));
+
+    const char* end = conflicted + conflictedSize;
+    const char* line = conflicted;
+    const char* ourStart = NULL;
+    const char* ourEnd = NULL;
+    const char* theirStart = NULL;
+    int state = 0; // 0 context, 1 ours, 2 base, 3 theirs
+    contextStart[0] = conflicted;
+    while (line < end) {
+        const char* newline = memchr(line, '\n', end - line);
+        const char* next = newline != NULL ? newline + 1 : end;
+        size_t length = next - line;
+        if (state == 0 && isMarkerLine(line, length, "<<<<<<< ")) {
+            contextLength[hunkCount] = line - contextStart[hunkCount];
+            ourStart = next;
+            state = 1;
+        } else if (state == 1 && isMarkerLine(line, length, "||||||| ")) {
+            ourEnd = line;
+            state = 2;
+        } else if (state == 2 && isMarkerLine(line, length, "=======")) {
+            theirStart = next;
+            state = 3;
+        } else if (state == 3 && isMarkerLine(line, length, ">>>>>>> ")) {
+            if (hunkCount == capacity) {
+                capacity *= 2;
+                contextStart = (const char**)realloc(contextStart, (capacity + 1) * sizeof(const char*));
+                contextLength = (size_t*)realloc(contextLength, (capacity + 1) * sizeof(size_t));
+                keys = (unsigned long long*)realloc(keys, capacity * sizeof(unsigned long long));
+            }
+            keys[hunkCount] = conflictKey(hashTextLines(ourStart, ourEnd - ourStart),
+                                          hashTextLines(theirStart, line - theirStart));
+            hunkCount++;
+            contextStart[hunkCount] = next;
+            state = 0;
+        }
+        line = next;
+    }
+    contextLength[hunkCount] = end - contextStart[hunkCount];
+
+    int recorded = 0;
+    if (state == 0 && hunkCount > 0 && resolvedSize >= contextLength[0] + contextLength[hunkCount] &&
+        memcmp(resolved, contextStart[0], contextLength[0]) == 0 &&
+        memcmp(resolved + resolvedSize - contextLength[hunkCount], contextStart[hunkCount], contextLength[hunkCount]) == 0) {
+        const char* position = resolved + contextLength[0];
+        const char* limit = resolved + resolvedSize - contextLength[hunkCount];
+        for (int i = 0; i < hunkCount; i++) {
+            const char* resolutionEnd = limit;
+            if (i + 1 < hunkCount) {
+                resolutionEnd = findText(position, limit - position, contextStart[i + 1], contextLength[i + 1]);
+                if (resolutionEnd == NULL) {
+                    break;
+                }
+            }
+            recorded += recordResolution(keys[i], position, resolutionEnd - position);
+            position = resolutionEnd + (i + 1 < hunkCount ? contextLength[i + 1] : 0);
+        }
+    }
+
+    free(contextStart);
+    free(contextLength);
+    free(keys);
+    return recorded;
+}
+
+// Line-level diff3: base lines kept by both sides are sync points, and each unstable
+// chunk between them takes whichever side changed it. Chunks changed differently on
+// both sides reuse a recorded resolution when one exists and otherwise become conflict
+// regions. Returns the number of conflicts left; *replayed counts reused resolutions.
+int mergeFileContents(const File* base, const File* ours, const File* theirs, textBuffer* result, int* replayed) {
+    lineTable baseLines;
+    lineTable ourLines;
+    lineTable theirLines;
+    splitLines(base, &baseLines, 1);
+    splitLines(ours, &ourLines, 1);
+    splitLines(theirs, &theirLines, 1);
+    int* ourMatch = matchLines(&baseLines, &ourLines);
+    int* theirMatch = matchLines(&baseLines, &theirLines);
+
+    int conflicts = 0;
+    int b = 0;
+    int o = 0;
+    int t = 0;
+    *replayed = 0;
+    while (b < baseLines.count || o < ourLines.count || t < theirLines.count) {
+        int sync = b;
+        while (sync < baseLines.count && (ourMatch[sync] == -1 || theirMatch[sync] == -1)) {
+            sync++;
+        }
+        int baseEnd = sync;
+        int ourEnd = sync < baseLines.count ? ourMatch[sync] : ourLines.count;
+        int theirEnd = sync < baseLines.count ? theirMatch[sync] : theirLines.count;
+
+        int ourChanged = !sameLineRange(&baseLines, b, baseEnd, &ourLines, o, ourEnd);
+        int theirChanged = !sameLineRange(&baseLines, b, baseEnd, &theirLines, t, theirEnd);
+        if (!ourChanged) {
+            appendLineRange(result, &theirLines, t, theirEnd);
+        } else if (!theirChanged || sameLineRange(&ourLines, o, ourEnd, &theirLines, t, theirEnd)) {
+            appendLineRange(result, &ourLines, o, ourEnd);
+        } else if (findRecordedResolution(conflictKey(hashLineRange(&ourLines, o, ourEnd),
+                                                      hashLineRange(&theirLines, t, theirEnd)), result)) {
+            (*replayed)++;
+        } else {
+            conflicts++;
+            appendConflictMarker(result, "<<<<<<< ours");
+            appendLineRange(result, &ourLines, o, ourEnd);
+            appendConflictMarker(result, "||||||| base");
+            appendLineRange(result, &baseLines, b, baseEnd);
+            appendConflictMarker(result, "=======");
+            appendLineRange(result, &theirLines, t, theirEnd);
+            appendConflictMarker(result, ">>>>>>> theirs");
+        }
+
+        if (sync == baseLines.count) {
+            break;
+        }
+        appendLineRange(result, &baseLines, sync, sync + 1);
+        b = sync + 1;
+        o = ourEnd + 1;
+        t = theirEnd + 1;
+    }
+
+    free(ourMatch);
+    free(theirMatch);
+    freeLineTable(&baseLines);
+    freeLineTable(&ourLines);
+    freeLineTable(&theirLines);
+    return conflicts;
+}
+
+// File and commit IDs share one namespace, so skip IDs used by either
+int nextObjectID(repository* repo) {
+    while (findFile(nextFileID, repo) != NULL || findCommit(repo, nextFileID) != NULL) {
+        nextFileID++;
+    }
+    return nextFileID++;
+}
+
+// Stores content under a fresh file ID so merge results become regular objects. Content
+// that does not fit a file is refused rather than stored truncated.
+File* storeFile(repository* repo, const char* data, size_t size) {
+    if (size >= MAX_FILE_CONTENT_SIZE) {
+        printf("Error: Content of %zu bytes exceeds the %d-byte file limit.\n", size, MAX_FILE_CONTENT_SIZE - 1);
+        return NULL;
+    }
+    File* newFile = (File*)malloc(sizeof(File));
+    if (newFile == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        return NULL;
+    }
+    newFile->fileID = nextObjectID(repo);
+    newFile->size = size;
+    memcpy(newFile->content, data, newFile->size);
+    newFile->content[newFile->size] = '\0';
+    newFile->contentHash = hashBytes(newFile->content, newFile->size);
+
+    int index = newFile->fileID % N;
+    newFile->next = repo->fileHash[index];
+    repo->fileHash[index] = newFile;
+    return newFile;
+}
+
+// A path changed on both sides, merged on the worker pool after tree-level resolution
+typedef struct pathMerge {
+    int reportIndex; // Entry in the merge report, which also holds the path
+    const File* base;
+    const File* ours;
+    const File* theirs;
+    int ourID;
+    int status; // MERGE_CLEAN, MERGE_REPLAYED or MERGE_CONTENT_CONFLICT
+    int keepOurs; // Set for binaries, which have no merged content
+    textBuffer merged;
+} pathMerge;
+
+// Content merge of one path. Only reads shared state, so it can run on any thread;
+// storing the result is left to the caller. An unmergeable binary pair is reported as
+// a content conflict and keeps ours.
+void mergePathContents(pathMerge* job) {
+    job->status = MERGE_CLEAN;
+    job->keepOurs = 0;
+    if ((job->base != NULL && isBinaryContent(job->base->content, job->base->size)) ||
+        (job->ours != NULL && isBinaryContent(job->ours->content, job->ours->size)) ||
+        (job->theirs != NULL && isBinaryContent(job->theirs->content, job->theirs->size))) {
+        job->status = MERGE_CONTENT_CONFLICT;
+        job->keepOurs = 1;
+        return;
+    }
+
+    int replayed;
+    if (mergeFileContents(job->base, job->ours, job->theirs, &job->merged, &replayed) > 0) {
+        job->status = MERGE_CONTENT_CONFLICT;
+    } else if (replayed > 0) {
+        job->status = MERGE_REPLAYED;
+    }
+}
+
+void pathMergeTask(void* context, int index) {
+    mergePathContents(&((pathMerge*)context)[index]);
+}
+
+int treeEntryID(const snapshot* tree, int index, const char* path) {
+    return index < tree->count && strcmp(tree->entries[index].path, path) == 0 ? tree->entries[index].fileID : -1;
+}
+
+void initMergeReport(mergeReport* report) {
+    report->conflicts = 0;
+    report->count = 0;
+    report->capacity = 0;
+    report->entries = NULL;
+}
+
+void freeMergeReport(mergeReport* report) {
+    free(report->entries);
+    report->entries = NULL;
+}
+
+void addMergeReportEntry(mergeReport* report, const char* path, int status) {
+    if (report->count == report->capacity) {
+        report->capacity = report->capacity > 0 ? report->capacity * 2 : 8;
+        report->entries = (mergeReportEntry*)realloc(report->entries, report->capacity * sizeof(mergeReportEntry));
+    }
+    mergeReportEntry* entry = &report->entries[report->count++];
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    entry->status = status;
+    if (status == MERGE_CONTENT_CONFLICT || status == MERGE_DELETE_CONFLICT) {
+        report->conflicts++;
+    }
+}
+
+void printMergeReport(const mergeReport* report) {
+    for (int i = 0; i < report->count; i++) {
+        const mergeReportEntry* entry = &report->entries[i];
+        if (entry->status == MERGE_CLEAN) {
+            printf("File %s merged successfully.\n", entry->path);
+        } else if (entry->status == MERGE_REPLAYED) {
+            printf("File %s merged using recorded conflict resolution.\n", entry->path);
+        } else if (entry->status == MERGE_DELETE_CONFLICT) {
+            printf("Conflict detected in file %s (modified on one side, deleted on the other). Manual resolution required.\n", entry->path);
+        } else {
+            printf("Conflict detected in file %s. Manual resolution required.\n", entry->path);
+        }
+    }
+}
+
+// Tree-level merge of three snapshots. Paths unchanged on one side resolve by object ID
+// without reading content; paths changed on both sides are content-merged in parallel
+// and their results stored in path order, so object IDs and the report stay deterministic.
+snapshot* applyChanges(repository* repo, const snapshot* baseTree, const snapshot* ourTree,
+                       const snapshot* theirTree, mergeReport* report) {
+    snapshot* merged = createSnapshot(ourTree->count + 1);
+    int jobCount = 0;
+    int jobCapacity = 16;
+    pathMerge* jobs = (pathMerge*)malloc(jobCapacity * sizeof(pathMerge));
+    int b = 0;
+    int o = 0;
+    int t = 0;
+    while (b < baseTree->count || o < ourTree->count || t < theirTree->count) {
+        const char* path = NULL;
+        if (b < baseTree->count) {
+            path = baseTree->entries[b].path;
+        }
+        if (o < ourTree->count && (path == NULL || strcmp(ourTree->entries[o].path, path) < 0)) {
+            path = ourTree->entries[o].path;
+        }
+        if (t < theirTree->count && (path == NULL || strcmp(theirTree->entries[t].path, path) < 0)) {
+            path = theirTree->entries[t].path;
+        }
+
+        int baseID = treeEntryID(baseTree, b, path);
+        int ourID = treeEntryID(ourTree, o, path);
+        int theirID = treeEntryID(theirTree, t, path);
+        char current[50];
+        snprintf(current, sizeof(current), "%s", path);
+        b += baseID != -1;
+        o += ourID != -1;
+        t += theirID != -1;
+
+        int resultID;
+        if (ourID == theirID || (ourID != -1 && theirID != -1 && sameObject(repo, ourID, theirID))) {
+            resultID = ourID;
+        } else if (baseID != -1 && ourID != -1 && sameObject(repo, baseID, ourID)) {
+            resultID = theirID;
+        } else if (baseID == ourID) {
+            resultID = theirID;
+        } else if (baseID == theirID || (baseID != -1 && theirID != -1 && sameObject(repo, baseID, theirID))) {
+            resultID = ourID;
+        } else if (ourID == -1 || theirID == -1) {
+            resultID = ourID != -1 ? ourID : theirID;
+            addMergeReportEntry(report, current, MERGE_DELETE_CONFLICT);
+        } else {
+            if (jobCount == jobCapacity) {
+                jobCapacity *= 2;
+                jobs = (pathMerge*)realloc(jobs, jobCapacity * sizeof(pathMerge));
+            }
+            pathMerge* job = &jobs[jobCount++];
+            job->reportIndex = report->count;
+            job->base = findFile(baseID, repo);
+            job->ours = findFile(ourID, repo);
+            job->theirs = findFile(theirID, repo);
+            job->ourID = ourID;
+            job->merged.data = NULL;
+            job->merged.size = 0;
+            job->merged.capacity = 0;
+            addMergeReportEntry(report, current, MERGE_CLEAN);
+            resultID = ourID; // Replaced once the content merge has run
+        }
+
+        if (resultID != -1) {
+            setTreeEntry(merged, current, resultID);
+        }
+    }
+
+    runParallelOrdered(jobCount, pathMergeTask, NULL, jobs);
+
+    for (int i = 0; i < jobCount; i++) {
+        pathMerge* job = &jobs[i];
+        mergeReportEntry* entry = &report->entries[job->reportIndex];
+        int resultID = job->ourID;
+        if (!job->keepOurs) {
+            File* result = storeFile(repo, job->merged.data != NULL ? job->merged.data : "", job->merged.size);
+            if (result != NULL) {
+                resultID = result->fileID;
+            } else {
+                // Our version stays in place and the path is left for the user to merge
+                printf("Conflict in file %s: the merged content could not be stored.\n", entry->path);
+                job->status = MERGE_CONTENT_CONFLICT;
+            }
+        }
+        setTreeEntry(merged, entry->path, resultID);
+        entry->status = job->status;
+        if (job->status == MERGE_CONTENT_CONFLICT) {
+            report->conflicts++;
+        }
+        free(job->merged.data);
+    }
+    free(jobs);
+    return merged;
+}
+
+graphNode* createTreeCommit(repository* repo, graphNode* parent, graphNode* mergeParent, snapshot* tree,
+                            const char* message, const char* author) {
+    commit* newCommit = (commit*)malloc(sizeof(commit));
+    if (newCommit == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        return NULL;
+    }
+    newCommit->fileID = nextObjectID(repo);
+    snprintf(newCommit->message, sizeof(newCommit->message), "%s", message);
+    snprintf(newCommit->author, sizeof(newCommit->author), "%s", author);
+    newCommit->fileCount = 0;
+    newCommit->originalFileName[0] = '\0';
+
+    time_t now = time(NULL);
+    struct tm* tm_info = localtime(&now);
+    strftime(newCommit->timestamp, sizeof(newCommit->timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+
+    graphNode* newNode = createGraphNode(newCommit);
+    newNode->parent = parent;
+    newNode->mergeParent = mergeParent;
+    newNode->tree = tree;
+    registerCommit(repo, newNode);
+    return newNode;
+}
+
+graphNode* createMergeCommit(repository* repo, graphNode* ours, graphNode* theirs, snapshot* tree) {
+    char message[100];
+    snprintf(message, sizeof(message), "Merge commit %d into %d", theirs->commit->fileID, ours->commit->fileID);
+    return createTreeCommit(repo, ours, theirs, tree, message, ours->commit->author);
+}
+
+graphNode* findMergeBase(repository* repo, graphNode* commit1, graphNode* commit2);
+
+// Merges two merge bases into an in-memory commit that stands in for both. Conflicts
+// are kept with their markers, as they only feed the outer merge.
+graphNode* createVirtualAncestor(repository* repo, graphNode* base1, graphNode* base2) {
+    graphNode* innerBase = findMergeBase(repo, base1, base2);
+    mergeReport report;
+    initMergeReport(&report);
+    snapshot* tree = applyChanges(repo, getSnapshot(innerBase), getSnapshot(base1), getSnapshot(base2), &report);
+    freeMergeReport(&report);
+
+    commit* virtualCommit = (commit*)calloc(1, sizeof(commit));
+    virtualCommit->fileID = nextVirtualID--;
+    snprintf(virtualCommit->message, sizeof(virtualCommit->message), "Virtual merge base of %d and %d",
+             base1->commit->fileID, base2->commit->fileID);
+    snprintf(virtualCommit->author, sizeof(virtualCommit->author), "System");
+
+    graphNode* virtualNode = createGraphNode(virtualCommit);
+    virtualNode->parent = base1;
+    virtualNode->mergeParent = base2;
+    retainVirtualBase(base1);
+    retainVirtualBase(base2);
+    virtualNode->tree = tree;
+    return virtualNode;
+}
+
+// Recursive merge base: with several best common ancestors they are folded into one
+// virtual ancestor. Every pair goes through the merge-base cache, so the intermediate
+// virtual merges of a criss-cross history are built once instead of exponentially often.
+graphNode* findMergeBase(repository* repo, graphNode* commit1, graphNode* commit2) {
+    if (commit1 == NULL || commit2 == NULL) {
+        return NULL;
+    }
+    graphNode* base;
+    if (lookupMergeBase(repo->mergeBases, commit1, commit2, &base)) {
+        return base;
+    }
+
+    graphNode** bases;
+    int count = findBestCommonAncestors(commit1, commit2, &bases);
+    base = count > 0 ? bases[0] : NULL;
+    for (int i = 1; i < count; i++) {
+        base = createVirtualAncestor(repo, base, bases[i]);
+    }
+    free(bases);
+
+    storeMergeBase(repo->mergeBases, commit1, commit2, base);
+    return base;
+}
+
+// Merges two commits purely in the object store: merged blobs are stored as files and
+// the result tree is returned, but nothing is written to the working directory.
+// Returns NULL when the commits share no history.
+snapshot* mergeTrees(repository* repo, graphNode* ours, graphNode* theirs, mergeReport* report) {
+    graphNode* commonAncestor = findMergeBase(repo, ours, theirs);
+    if (commonAncestor == NULL) {
+        return NULL;
+    }
+    return applyChanges(repo, getSnapshot(commonAncestor), getSnapshot(ours), getSnapshot(theirs), report);
+}
+
+// Dry-run merge for headless callers: returns the ID of a candidate merge commit that
+// is not on any branch, or -1 with the conflicts listed in the report. When one side
+// already contains the other no commit is created and the containing tip is returned.
+int mergeInMemory(repository* repo, int ourID, int theirID, mergeReport* report) {
+    graphNode* ours = findCommit(repo, ourID);
+    graphNode* theirs = findCommit(repo, theirID);
+    if (ours == NULL || theirs == NULL) {
+        return -1;
+    }
+    if (isAncestor(theirs, ours)) {
+        return ourID;
+    }
+    if (isAncestor(ours, theirs)) {
+        return theirID;
+    }
+    snapshot* merged = mergeTrees(repo, ours, theirs, report);
+    if (merged == NULL) {
+        return -1;
+    }
+    if (report->conflicts > 0) {
+        freeSnapshot(merged);
+        return -1;
+    }
+    graphNode* candidate = createMergeCommit(repo, ours, theirs, merged);
+    if (candidate == NULL) {
+        freeSnapshot(merged);
+        return -1;
+    }
+    return candidate->commit->fileID;
+}
+
+// Remembers what a conflicted merge wrote so the user's resolutions can be recorded later
+void rememberConflicts(repository* repo, const mergeReport* report, const snapshot* merged) {
+    freeSnapshot(repo->worktree->pendingResolutions);
+    repo->worktree->pendingResolutions = createSnapshot(report->count);
+    for (int i = 0; i < report->count; i++) {
+        int index = findTreeEntry(merged, report->entries[i].path);
+        if (report->entries[i].status == MERGE_CONTENT_CONFLICT && index >= 0) {
+            setTreeEntry(repo->worktree->pendingResolutions, report->entries[i].path, merged->entries[index].fileID);
+        }
+    }
+}
+
+void clearPendingMerge(worktree* tree) {
+    if (tree->merge == NULL) {
+        return;
+    }
+    freeSnapshot(tree->merge->tree);
+    freeSnapshot(tree->merge->conflicts);
+    free(tree->merge);
+    tree->merge = NULL;
+}
+
+// Whether the pending merge can be committed: the branch has not moved and no conflicted
+// path in the working directory still has conflict markers
+int mergeResolved(repository* repo) {
+    pendingMerge* pending = repo->worktree->merge;
+    if (!isCurrentTip(repo, pending->ours)) {
+        printf("Error: The branch moved since the merge; abort the merge and merge again.\n");
+        return 0;
+    }
+    int resolved = 1;
+    for (int i = 0; i < pending->conflicts->count; i++) {
+        const char* path = pending->conflicts->entries[i].path;
+        char location[WORKING_PATH_LENGTH];
+        size_t size;
+        char* data = readWholeFile(workingPath(repo, path, location), &size);
+        if (data == NULL) {
+            printf("Error: Unable to read %s.\n", path);
+            resolved = 0;
+        } else if (findText(data, size, "<<<<<<< ", 8) != NULL) {
+            printf("Error: %s still has conflict markers.\n", path);
+            resolved = 0;
+        } else if (size >= MAX_FILE_CONTENT_SIZE) {
+            printf("Error: %s is larger than the %d-byte file limit.\n", path, MAX_FILE_CONTENT_SIZE - 1);
+            resolved = 0;
+        }
+        free(data);
+    }
+    if (!resolved) {
+        printf("Resolve the conflicts before committing, or abort the merge.\n");
+    }
+    return resolved;
+}
+
+// The pending merge's result with the conflicted paths stored from the working
+// directory, for the commit concluding it; fileName is already stored as fileID
+snapshot* resolvedMergeTree(repository* repo, const char* fileName, int fileID) {
+    pendingMerge* pending = repo->worktree->merge;
+    snapshot* tree = copySnapshot(pending->tree);
+    for (int i = 0; i < pending->conflicts->count; i++) {
+        const char* path = pending->conflicts->entries[i].path;
+        if (strcmp(path, fileName) == 0) {
+            continue;
+        }
+        char location[WORKING_PATH_LENGTH];
+        size_t size;
+        char* data = readWholeFile(workingPath(repo, path, location), &size);
+        File* stored = data != NULL ? storeFile(repo, data, size) : NULL;
+        free(data);
+        if (stored != NULL) {
+            setTreeEntry(tree, path, stored->fileID);
+        }
+    }
+    setTreeEntry(tree, fileName, fileID);
+    return tree;
+}
+
+// Puts the working directory back to the branch tip and forgets the pending merge,
+// discarding whatever was resolved so far
+void abortMerge(repository* repo) {
+    pendingMerge* pending = repo->worktree->merge;
+    if (pending == NULL) {
+        printf("No merge in progress.\n");
+        return;
+    }
+    const snapshot* head = getSnapshot(repo->nodes[repo->worktree->currentBranchIndex]);
+    const snapshot* fromView = sparseView(repo, pending->tree);
+    const snapshot* toView = sparseView(repo, head);
+    writeTreeChanges(repo, fromView, toView);
+    freeSparseView(fromView, pending->tree);
+    freeSparseView(toView, head);
+    clearPendingMerge(repo->worktree);
+    freeSnapshot(repo->worktree->pendingResolutions);
+    repo->worktree->pendingResolutions = NULL;
+    printf("Merge aborted.\n");
+}
+
+void merge(repository* repo, graphNode* commit1, graphNode* commit2) {
+    if (commit1 == NULL || commit2 == NULL) {
+        printf("Error: Commit not found.\n");
+        return;
+    }
+    if (repo->worktree->merge != NULL) {
+        printf("Error: A merge is in progress; commit its resolution or abort it first.\n");
+        return;
+    }
+    if (isAncestor(commit2, commit1)) {
+        printf("Already up to date.\n");
+        return;
+    }
+    // Fast-forward: nothing to merge, the branch just moves to the other tip
+    if (isAncestor(commit1, commit2)) {
+        if (!isCurrentTip(repo, commit1)) {
+            printf("Already up to date: commit %d is not the current branch tip, nothing to move.\n",
+                   commit1->commit->fileID);
+            return;
+        }
+        if (!updateWorkingTree(repo, getSnapshot(commit1), getSnapshot(commit2))) {
+            printf("Merge aborted.\n");
+            return;
+        }
+        updateBranch(repo, repo->branches[repo->worktree->currentBranchIndex], commit1, commit2, "merge: fast-forward");
+        printf("Fast-forward to commit %d.\n", commit2->commit->fileID);
+        return;
+    }
+
+    mergeReport report;
+    initMergeReport(&report);
+    snapshot* merged = mergeTrees(repo, commit1, commit2, &report);
+
+    if (merged == NULL) {
+        printf("No common ancestor found. Merge aborted.\n");
+        return;
+    }
+
+    printMergeReport(&report);
+    // The working directory shows the current branch: only a merge into it may write there
+    int intoHead = isCurrentTip(repo, commit1);
+    if (report.conflicts > 0 && !intoHead) {
+        printf("Merge aborted: check out the branch at commit %d to resolve the conflicts.\n", commit1->commit->fileID);
+        freeSnapshot(merged);
+        freeMergeReport(&report);
+        return;
+    }
+    if (intoHead && !updateWorkingTree(repo, getSnapshot(commit1), merged)) {
+        printf("Merge aborted.\n");
+        freeSnapshot(merged);
+        freeMergeReport(&report);
+        return;
+    }
+
+    if (report.conflicts > 0) {
+        rememberConflicts(repo, &report, merged);
+        pendingMerge* pending = (pendingMerge*)malloc(sizeof(pendingMerge));
+        pending->ours = commit1;
+        pending->theirs = commit2;
+        pending->tree = merged;
+        pending->conflicts = copySnapshot(repo->worktree->pendingResolutions);
+        repo->worktree->merge = pending;
+        printf("Merge finished with %d conflicted file(s); commit the resolution or abort the merge.\n",
+               report.conflicts);
+        freeMergeReport(&report);
+        return;
+    }
+    freeMergeReport(&report);
+
+    graphNode* mergeNode = createMergeCommit(repo, commit1, commit2, merged);
+    if (mergeNode == NULL) {
+        freeSnapshot(merged);
+        return;
+    }
+    if (intoHead) {
+        updateBranch(repo, repo->branches[repo->worktree->currentBranchIndex], commit1, mergeNode, "merge");
+    }
+    printf("Merge successful. Created merge commit %d.\n", mergeNode->commit->fileID);
+}
+
+// Replays commits on top of onto as one batch, then moves the current branch there.
+// Each step is a three-way merge whose base is the replayed commit's first parent (the
+// commit itself when reverting), done in memory on top of the previous step; the
+// working tree, currently showing start, is written once at the end. Stops at the first
+// conflicting commit, leaving its conflicts in the working tree. Returns the number of
+// commits applied.
+int replayCommits(repository* repo, graphNode* start, graphNode* onto, graphNode** commits, int count, int mode) {
+    const char* action = mode == REPLAY_REVERT ? "Revert" : mode == REPLAY_REBASE ? "Rebase" : "Cherry-pick";
+    if (!workingTreeClean(repo, getSnapshot(start))) {
+        printf("%s aborted.\n", action);
+        return 0;
+    }
+    graphNode* head = onto;
+    snapshot* conflictTree = NULL;
+    mergeReport conflictReport;
+    initMergeReport(&conflictReport);
+    int applied = 0;
+    for (int i = 0; i < count; i++) {
+        graphNode* source = commits[i];
+        snapshot* base = mode == REPLAY_REVERT ? getSnapshot(source) : getSnapshot(source->parent);
+        snapshot* theirs = mode == REPLAY_REVERT ? getSnapshot(source->parent) : getSnapshot(source);
+
+        mergeReport report;
+        initMergeReport(&report);
+        snapshot* merged = applyChanges(repo, base, getSnapshot(head), theirs, &report);
+        if (report.conflicts > 0) {
+            printf("%s of commit %d stopped with conflicts:\n", action, source->commit->fileID);
+            printMergeReport(&report);
+            freeMergeReport(&conflictReport);
+            conflictReport = report;
+            conflictTree = merged;
+            break;
+        }
+        freeMergeReport(&report);
+
+        char message[100];
+        if (mode == REPLAY_REVERT) {
+            snprintf(message, sizeof(message), "Revert \"%.80s\"", source->commit->message);
+        } else if (mode == REPLAY_CHERRY_PICK) {
+            snprintf(message, sizeof(message), "%.60s (cherry picked from %d)", source->commit->message,
+                     source->commit->fileID);
+        } else {
+            snprintf(message, sizeof(message), "%s", source->commit->message);
+        }
+        graphNode* replayed = createTreeCommit(repo, head, NULL, merged, message, source->commit->author);
+        if (replayed == NULL) {
+            freeSnapshot(merged);
+            break;
+        }
+        head = replayed;
+        applied++;
+    }
+
+    // Untracked files the replayed commits would overwrite abort it before the branch moves
+    if (!updateWorkingTree(repo, getSnapshot(start), conflictTree != NULL ? conflictTree : getSnapshot(head))) {
+        printf("%s aborted.\n", action);
+        freeSnapshot(conflictTree);
+        freeMergeReport(&conflictReport);
+        return 0;
+    }
+    if (conflictTree != NULL) {
+        rememberConflicts(repo, &conflictReport, conflictTree);
+    }
+    freeSnapshot(conflictTree);
+    freeMergeReport(&conflictReport);
+    if (head != start) {
+        char reason[REFLOG_MESSAGE_LENGTH];
+        snprintf(reason, sizeof(reason), "%s: %d commit(s)", action, applied);
+        updateBranch(repo, repo->branches[repo->worktree->currentBranchIndex], start, head, reason);
+    }
+    printf("%s: applied %d of %d commit(s).\n", action, applied, count);
+    return applied;
+}
+
+// Cherry-picks (or reverts) a list of commits onto the current branch
+int pickCommits(repository* repo, const int* commitIDs, int count, int revert) {
+    if (repo->worktree->currentBranchIndex < 0 || repo->nodes[repo->worktree->currentBranchIndex] == NULL) {
+        printf("Error: Current branch has no commits.\n");
+        return 0;
+    }
+    graphNode** commits = (graphNode**)malloc(count * sizeof(graphNode*));
+    for (int i = 0; i < count; i++) {
+        commits[i] = findCommit(repo, commitIDs[i]);
+        if (commits[i] == NULL) {
+            printf("Error: Commit %d not found.\n", commitIDs[i]);
+            free(commits);
+            return 0;
+        }
+    }
+    graphNode* tip = repo->nodes[repo->worktree->currentBranchIndex];
+    int applied = replayCommits(repo, tip, tip, commits, count, revert ? REPLAY_REVERT : REPLAY_CHERRY_PICK);
+    free(commits);
+    return applied;
+}
+
+// Patch ID of one changed path: the path plus the removed and added lines, without
+// line numbers, so the same change made on a different base hashes the same
+unsigned long long pathPatchID(repository* repo, const char* path, int oldID, int newID) {
+    unsigned long long hash = hashBytes(path, strlen(path));
+    File* oldFile = oldID != -1 ? findFile(oldID, repo) : NULL;
+    File* newFile = newID != -1 ? findFile(newID, repo) : NULL;
+    if ((oldFile != NULL && isBinaryContent(oldFile->content, oldFile->size)) ||
+        (newFile != NULL && isBinaryContent(newFile->content, newFile->size))) {
+        hash = foldLineHash(hash, oldFile != NULL ? oldFile->contentHash : 0);
+        return foldLineHash(hash, newFile != NULL ? newFile->contentHash : 0);
+    }
+
+    lineTable oldLines;
+    lineTable newLines;
+    splitLines(oldFile, &oldLines, 0);
+    splitLines(newFile, &newLines, 0);
+    int* match = matchLines(&oldLines, &newLines);
+    char* kept = (char*)calloc(newLines.count + 1, 1);
+    for (int i = 0; i < oldLines.count; i++) {
+        if (match[i] < 0) {
+            hash = foldLineHash(hash, mixHash(oldLines.hashes[i] ^ '-'));
+        } else {
+            kept[match[i]] = 1;
+        }
+    }
+    for (int j = 0; j < newLines.count; j++) {
+        if (!kept[j]) {
+            hash = foldLineHash(hash, mixHash(newLines.hashes[j] ^ '+'));
+        }
+    }
+    free(kept);
+    free(match);
+    freeLineTable(&oldLines);
+    freeLineTable(&newLines);
+    return hash;
+}
+
+// Patch ID of a commit against its first parent, over changed paths in path order
+unsigned long long commitPatchID(repository* repo, graphNode* node) {
+    const snapshot* oldTree = getSnapshot(node->parent);
+    const snapshot* newTree = getSnapshot(node);
+    unsigned long long hash = 0;
+    int i = 0;
+    int j = 0;
+    while (i < oldTree->count || j < newTree->count) {
+        int order;
+        if (i == oldTree->count) {
+            order = 1;
+        } else if (j == newTree->count) {
+            order = -1;
+        } else {
+            order = strcmp(oldTree->entries[i].path, newTree->entries[j].path);
+        }
+
+        if (order < 0) {
+            hash = foldLineHash(hash, pathPatchID(repo, oldTree->entries[i].path, oldTree->entries[i].fileID, -1));
+            i++;
+        } else if (order > 0) {
+            hash = foldLineHash(hash, pathPatchID(repo, newTree->entries[j].path, -1, newTree->entries[j].fileID));
+            j++;
+        } else {
+            int oldID = oldTree->entries[i].fileID;
+            int newID = newTree->entries[j].fileID;
+            if (oldID != newID && !sameObject(repo, oldID, newID)) {
+                hash = foldLineHash(hash, pathPatchID(repo, newTree->entries[j].path, oldID, newID));
+            }
+            i++;
+            j++;
+        }
+    }
+    return hash;
+}
+
+int compareUnsignedLongLong(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Commits reachable from tip but not from base, following both parents, oldest first.
+// Both ends are painted in generation order as in findBestCommonAncestors and the walk
+// stops once only commits reachable from base are left. Merge commits are dropped as
+// they have no single patch to replay; the side commits they brought in are kept.
+int collectCommitsSince(graphNode* tip, graphNode* base, graphNode*** result) {
+    nodeSet flags;
+    nodeHeap heap = {NULL, NULL, 0, 0, 0};
+    initNodeSet(&flags);
+    *nodeSetValue(&flags, tip) |= FLAG_PARENT1;
+    heapPush(&heap, tip, 1);
+    if (base != NULL) {
+        *nodeSetValue(&flags, base) |= FLAG_PARENT2;
+        heapPush(&heap, base, 0);
+    }
+
+    int count = 0;
+    int capacity = 64;
+    graphNode** commits = (graphNode**)malloc(capacity * sizeof(graphNode*));
+    while (heap.count > 0 && heap.activeCount > 0) {
+        graphNode* node = heapPop(&heap);
+        int* nodeFlags = nodeSetValue(&flags, node);
+        int paint = *nodeFlags & (FLAG_PARENT1 | FLAG_PARENT2);
+        if (paint == FLAG_PARENT1 && !(*nodeFlags & FLAG_RESULT)) {
+            *nodeFlags |= FLAG_RESULT;
+            if (node->mergeParent == NULL) {
+                if (count == capacity) {
+                    capacity *= 2;
+                    commits = (graphNode**)realloc(commits, capacity * sizeof(graphNode*));
+                }
+                commits[count++] = node;
+            }
+        }
+        graphNode* parents[2] = {node->parent, node->mergeParent};
+        for (int p = 0; p < 2; p++) {
+            if (parents[p] == NULL) {
+                continue;
+            }
+            int* parentFlags = nodeSetValue(&flags, parents[p]);
+            if ((*parentFlags & paint) == paint) {
+                continue;
+            }
+            *parentFlags |= paint;
+            heapPush(&heap, parents[p], paint == FLAG_PARENT1);
+        }
+    }
+    freeNodeHeap(&heap);
+    freeNodeSet(&flags);
+
+    // Popped newest first; a parent always has a lower generation than its children
+    for (int i = 0; i < count / 2; i++) {
+        graphNode* swap = commits[i];
+        commits[i] = commits[count - 1 - i];
+        commits[count - 1 - i] = swap;
+    }
+    *result = commits;
+    return count;
+}
+
+// Replays the current branch's commits since the merge base on top of upstream, in
+// memory, skipping commits whose patch is already upstream
+void rebase(repository* repo, graphNode* upstream) {
+    if (repo->worktree->currentBranchIndex < 0 || repo->nodes[repo->worktree->currentBranchIndex] == NULL) {
+        printf("Error: Current branch has no commits.\n");
+        return;
+    }
+    graphNode* head = repo->nodes[repo->worktree->currentBranchIndex];
+    if (isAncestor(upstream, head)) {
+        printf("Current branch is up to date.\n");
+        return;
+    }
+    if (!workingTreeClean(repo, getSnapshot(head))) {
+        printf("Rebase aborted.\n");
+        return;
+    }
+    if (isAncestor(head, upstream)) {
+        if (!updateWorkingTree(repo, getSnapshot(head), getSnapshot(upstream))) {
+            printf("Rebase aborted.\n");
+            return;
+        }
+        updateBranch(repo, repo->branches[repo->worktree->currentBranchIndex], head, upstream, "rebase: fast-forward");
+        printf("Fast-forwarded to commit %d.\n", upstream->commit->fileID);
+        return;
+    }
+    graphNode* base = findMergeBase(repo, head, upstream);
+
+    graphNode** upstreamCommits;
+    int upstreamCount = collectCommitsSince(upstream, base, &upstreamCommits);
+    unsigned long long* upstreamPatches = (unsigned long long*)malloc((upstreamCount + 1) * sizeof(unsigned long long));
+    for (int i = 0; i < upstreamCount; i++) {
+        upstreamPatches[i] = commitPatchID(repo, upstreamCommits[i]);
+    }
+    qsort(upstreamPatches, upstreamCount, sizeof(unsigned long long), compareUnsignedLongLong);
+    free(upstreamCommits);
+
+    graphNode** commits;
+    int count = collectCommitsSince(head, base, &commits);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned long long patchID = commitPatchID(repo, commits[i]);
+        if (upstreamCount > 0 && bsearch(&patchID, upstreamPatches, upstreamCount, sizeof(unsigned long long),
+                                         compareUnsignedLongLong) != NULL) {
+            printf("Skipping commit %d: already upstream.\n", commits[i]->commit->fileID);
+            continue;
+        }
+        commits[kept++] = commits[i];
+    }
+    free(upstreamPatches);
+
+    replayCommits(repo, head, upstream, commits, kept, REPLAY_REBASE);
+    free(commits);
+}
+
+//-----------------PACKED REFS------------------------------------------
+
+// Layout: a 12-byte header ("SVRT", version, padding, u32 block size), fixed-size blocks
+// of sorted records, an index of each block's first name, then a 16-byte footer (u32
+// index offset, u32 block count, u32 ref count, "SVRT"). A record is varint shared-prefix
+// length, varint suffix length, suffix, type byte and zigzag varint commit ID. Every
+// REFTABLE_RESTART_INTERVAL-th record stores its full name; a block ends with the u32
+// offsets of those restart points and a u16 count. Integers are little-endian.
+
+void appendU32(deltaBuffer* buffer, unsigned int value) {
+    unsigned char bytes[4];
+    writeU32(bytes, value);
+    appendDeltaBytes(buffer, bytes, 4);
+}
+
+size_t zigzag(int value) {
+    return value < 0 ? ((size_t)(-(long long)value) << 1) - 1 : (size_t)value << 1;
+}
+
+int unzigzag(size_t value) {
+    return value & 1 ? (int)-(long long)((value + 1) >> 1) : (int)(value >> 1);
 }
 
-void printFileList() {
-    printf("File List:\n");
-    File* temp = head;
-    while (temp != NULL) {
-        printf("File ID: %d\n", temp->fileID);
-        printf("Content:\n%s\n", temp->content);
-        temp = temp->next;
+typedef struct refTableWriter {
+    deltaBuffer file;
+    deltaBuffer block;
+    deltaBuffer index;
+    unsigned int restarts[REFTABLE_BLOCK_SIZE / 4];
+    int restartCount;
+    int recordsInBlock;
+    int blockCount;
+    int refCount;
+    char previous[MAX_BRANCH_NAME_LENGTH];
+} refTableWriter;
+
+void flushRefBlock(refTableWriter* writer) {
+    if (writer->recordsInBlock == 0) {
+        return;
     }
+    size_t trailer = writer->restartCount * 4 + 2;
+    while (writer->block.size + trailer < REFTABLE_BLOCK_SIZE) {
+        unsigned char zero = 0;
+        appendDeltaBytes(&writer->block, &zero, 1);
+    }
+    for (int i = 0; i < writer->restartCount; i++) {
+        appendU32(&writer->block, writer->restarts[i]);
+    }
+    unsigned char count[2] = {writer->restartCount & 0xff, writer->restartCount >> 8};
+    appendDeltaBytes(&writer->block, count, 2);
+    appendDeltaBytes(&writer->file, writer->block.data, writer->block.size);
+    writer->block.size = 0;
+    writer->restartCount = 0;
+    writer->recordsInBlock = 0;
+    writer->blockCount++;
 }
 
-void cloneBranch(repository* repo, const char* originalBranchName, const char* newBranchName) {
-    int originalBranchIndex = -1;
-    for (int i = 0; i < repo->branchCount; i++) {
-        if (strcmp(repo->branches[i], originalBranchName) == 0) {
-            originalBranchIndex = i;
-            break;
+// Names must arrive in strictly increasing order
+void writeRefRecord(refTableWriter* writer, const char* name, int type, int target, int peeled) {
+    size_t length = strlen(name);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int restart = writer->recordsInBlock % REFTABLE_RESTART_INTERVAL == 0;
+        size_t shared = 0;
+        if (!restart) {
+            while (shared < length && name[shared] == writer->previous[shared]) {
+                shared++;
+            }
+        }
+        deltaBuffer record = {NULL, 0, 0, 0, 0};
+        appendDeltaVarint(&record, shared);
+        appendDeltaVarint(&record, length - shared);
+        appendDeltaBytes(&record, (const unsigned char*)name + shared, length - shared);
+        unsigned char typeByte = (unsigned char)type;
+        appendDeltaBytes(&record, &typeByte, 1);
+        appendDeltaVarint(&record, zigzag(target));
+        if (type == REF_ANNOTATED_TAG) {
+            appendDeltaVarint(&record, zigzag(peeled));
+        }
+
+        size_t trailer = (writer->restartCount + restart) * 4 + 2;
+        if (writer->block.size + record.size + trailer > REFTABLE_BLOCK_SIZE && writer->recordsInBlock > 0) {
+            free(record.data);
+            flushRefBlock(writer);
+            continue;
+        }
+        if (writer->recordsInBlock == 0) {
+            appendU32(&writer->index, (unsigned int)length);
+            appendDeltaBytes(&writer->index, (const unsigned char*)name, length);
         }
+        if (restart) {
+            writer->restarts[writer->restartCount++] = (unsigned int)writer->block.size;
+        }
+        appendDeltaBytes(&writer->block, record.data, record.size);
+        free(record.data);
+        writer->recordsInBlock++;
+        writer->refCount++;
+        snprintf(writer->previous, sizeof(writer->previous), "%s", name);
+        return;
     }
+}
 
-    if (originalBranchIndex == -1) {
-        printf("Error: Original branch '%s' not found.\n", originalBranchName);
+void packRefVisitor(repository* repo, int refIndex, void* context) {
+    graphNode* tip = repo->nodes[refIndex];
+    if (tip == NULL) {
         return;
     }
+    const char* name = repo->branches[refIndex];
+    int commitID = tip->commit->fileID;
+    if (repo->refObjects[refIndex] >= 0) {
+        // The peeled commit is cached so resolving the tag never reads the tag object
+        writeRefRecord((refTableWriter*)context, name, REF_ANNOTATED_TAG, repo->refObjects[refIndex], commitID);
+    } else {
+        writeRefRecord((refTableWriter*)context, name, isTagRef(name) ? REF_TAG : REF_BRANCH, commitID, commitID);
+    }
+}
 
-    int newBranchIndex = repo->branchCount;
-    if (newBranchIndex < N) {
-        repo->branches[newBranchIndex] = strdup(newBranchName);
-        repo->branchCount++;
+// Writes every branch into the packed ref table, replacing the old one atomically. The
+// table is an export of this session's ref store, whose commit IDs it holds: lookups go
+// to the store, and any ref update removes the table rather than leave it stale.
+int packRefs(repository* repo) {
+    if (!ensureRepoDirectory()) {
+        printf("Error: Cannot create %s.\n", REPO_DIR);
+        return 0;
+    }
+    refTableWriter* writer = (refTableWriter*)calloc(1, sizeof(refTableWriter));
+    appendDeltaBytes(&writer->file, (const unsigned char*)REFTABLE_MAGIC, 4);
+    unsigned char version[4] = {REFTABLE_VERSION, 0, 0, 0};
+    appendDeltaBytes(&writer->file, version, 4);
+    appendU32(&writer->file, REFTABLE_BLOCK_SIZE);
 
-        graphNode* originalBranchHead = repo->nodes[originalBranchIndex];
-        if (originalBranchHead == NULL) {
-            printf("Error: No commits in the original branch.\n");
-            return;
-        }
+    forEachRef(repo, "", packRefVisitor, writer);
+    flushRefBlock(writer);
 
-        graphNode* newBranchHead = NULL;
-        graphNode* lastNode = NULL;
-        while (originalBranchHead != NULL) {
-            graphNode* newNode = createGraphNode(originalBranchHead->commit);
-            if (newBranchHead == NULL) {
-                newBranchHead = newNode;
-            }
-            if (lastNode != NULL) {
-                lastNode->nextParent = newNode;
-            }
-            lastNode = newNode;
-            originalBranchHead = originalBranchHead->nextParent;
-        }
-        repo->nodes[newBranchIndex] = newBranchHead;
-    } else {
-        printf("Error: Maximum number of branches reached.\n");
+    // The index is a table of u32 offsets into a list of length-prefixed first names
+    unsigned int indexOffset = (unsigned int)writer->file.size;
+    size_t position = 0;
+    for (int i = 0; i < writer->blockCount; i++) {
+        appendU32(&writer->file, (unsigned int)(writer->blockCount * 4 + position));
+        position += 4 + readU32(writer->index.data + position);
     }
+    appendDeltaBytes(&writer->file, writer->index.data, writer->index.size);
+    appendU32(&writer->file, indexOffset);
+    appendU32(&writer->file, writer->blockCount);
+    appendU32(&writer->file, writer->refCount);
+    appendDeltaBytes(&writer->file, (const unsigned char*)REFTABLE_MAGIC, 4);
 
-    printf("Branch '%s' created from branch '%s'.\n", newBranchName, originalBranchName);
+    int written = writeWholeFile(PACKED_REFS ".tmp", (const char*)writer->file.data, writer->file.size) &&
+                  replaceFile(PACKED_REFS ".tmp", PACKED_REFS);
+    printf("Packed %d ref(s) into %d block(s).\n", writer->refCount, writer->blockCount);
+    free(writer->file.data);
+    free(writer->block.data);
+    free(writer->index.data);
+    free(writer);
+    return written;
 }
 
-void createBranch(repository* repo, const char* branchName) {
-    if (repo->branchCount < N) {
-        for (int i = 0; i < repo->branchCount; i++) {
-            if (strcmp(repo->branches[i], branchName) == 0) {
-                printf("Error: Branch '%s' already exists.\n", branchName);
-                return;
-            }
-        }
-
-        const char* originalBranchName = repo->branches[repo->currentBranchIndex];
-        cloneBranch(repo, originalBranchName, branchName);
+void closeRefTable(refTable* table) {
+#ifndef _WIN32
+    if (table->mapped) {
+        munmap((void*)table->data, table->size);
     } else {
-        printf("Error: Maximum number of branches reached.\n");
+        free((void*)table->data);
     }
+#else
+    free((void*)table->data);
+#endif
+    table->data = NULL;
 }
 
-void checkoutBranch(repository* repo, const char* branchName) {
-    int branchIndex = -1;
-    for (int i = 0; i < repo->branchCount; i++) {
-        if (strcmp(repo->branches[i], branchName) == 0) {
-            branchIndex = i;
-            break;
+int openRefTable(const char* path, refTable* table) {
+    table->data = NULL;
+    table->mapped = 0;
+#ifndef _WIN32
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return 0;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) == 0 && info.st_size > 0) {
+        void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping != MAP_FAILED) {
+            table->data = (const unsigned char*)mapping;
+            table->size = info.st_size;
+            table->mapped = 1;
         }
     }
-
-    if (branchIndex == -1) {
-        printf("Branch not found: %s\n", branchName);
-        return;
+    close(descriptor);
+#else
+    table->data = (const unsigned char*)readWholeFile(path, &table->size);
+#endif
+    if (table->data == NULL) {
+        return 0;
     }
-
-    repo->currentBranchIndex = branchIndex;
-    printf("Switched to branch: %s\n", branchName);
+    const unsigned char* footer = table->data + table->size - 16;
+    if (table->size < 28 || memcmp(table->data, REFTABLE_MAGIC, 4) != 0 || memcmp(footer + 12, REFTABLE_MAGIC, 4) != 0) {
+        closeRefTable(table);
+        return 0;
+    }
+    table->blockSize = readU32(table->data + 8);
+    table->indexOffset = readU32(footer);
+    table->blockCount = readU32(footer + 4);
+    table->refCount = readU32(footer + 8);
+    return 1;
 }
 
-void freeCommitTree(graphNode* root) {
-    if (root != NULL) {
-        freeCommitTree(root->nextParent);
-        free(root->commit);
-        free(root);
+// First name of a block, from the index
+int compareBlockKey(const refTable* table, unsigned int block, const char* name) {
+    const unsigned char* index = table->data + table->indexOffset;
+    const unsigned char* entry = index + readU32(index + block * 4);
+    size_t length = readU32(entry);
+    size_t nameLength = strlen(name);
+    int order = memcmp(entry + 4, name, length < nameLength ? length : nameLength);
+    if (order != 0) {
+        return order;
     }
+    return length < nameLength ? -1 : length > nameLength;
 }
 
-void printRepository(repository* repo) {
-    printf("Repository Contents:\n");
-    printf("Current Branch Index: %d\n", repo->currentBranchIndex);
-    printf("Branch Count: %d\n", repo->branchCount);
+const unsigned char* refBlock(const refTable* table, unsigned int block) {
+    return table->data + 12 + (size_t)block * table->blockSize;
+}
 
-    printf("Branches:\n");
-    for (int i = 0; i < repo->branchCount; i++) {
-        printf("%d: %s\n", i, repo->branches[i]);
-    }
+int refRestartCount(const refTable* table, unsigned int block) {
+    const unsigned char* end = refBlock(table, block) + table->blockSize;
+    return end[-2] | (end[-1] << 8);
+}
 
-    printf("File Hash:\n");
-    for (int i = 0; i < N; i++) {
-        printf("Index %d:\n", i);
-        File* file = repo->fileHash[i];
-        while (file != NULL) {
-            printf("File ID: %d\n", file->fileID);
-            printf("Content:\n%s\n", file->content);
-            file = file->next;
+// Decodes the record at the cursor into cursor->name; 0 at the end of the block
+int readRefRecord(refCursor* cursor) {
+    const unsigned char* block = refBlock(cursor->table, cursor->block);
+    const unsigned char* end = block + cursor->table->blockSize - refRestartCount(cursor->table, cursor->block) * 4 - 2;
+    const unsigned char* position = block + cursor->offset;
+    size_t shared;
+    size_t suffix;
+    size_t target;
+    if (!readDeltaVarint(&position, end, &shared) || !readDeltaVarint(&position, end, &suffix) ||
+        (shared == 0 && suffix == 0) || shared + suffix >= MAX_BRANCH_NAME_LENGTH ||
+        position + suffix + 1 > end) {
+        return 0;
+    }
+    memcpy(cursor->name + shared, position, suffix);
+    cursor->name[shared + suffix] = '\0';
+    position += suffix;
+    cursor->type = *position++;
+    if (!readDeltaVarint(&position, end, &target)) {
+        return 0;
+    }
+    cursor->target = unzigzag(target);
+    cursor->peeled = cursor->target;
+    if (cursor->type == REF_ANNOTATED_TAG) {
+        if (!readDeltaVarint(&position, end, &target)) {
+            return 0;
         }
+        cursor->peeled = unzigzag(target);
     }
+    cursor->offset = position - block;
+    return 1;
+}
 
-    printf("Commit Nodes:\n");
-    for (int i = 0; i < N; i++) {
-        printf("Index %d:\n", i);
-        graphNode* node = repo->nodes[i];
-        while (node != NULL) {
-            printf("Message: %s\n", node->commit->message);
-            printf("File ID: %d\n", node->commit->fileID);
-            printf("Author: %s\n", node->commit->author);
-            printf("Timestamp: %s\n", node->commit->timestamp);
-            node = node->nextParent;
+// Moves to the next record, crossing into the next block as needed
+void advanceRefCursor(refCursor* cursor) {
+    while (!readRefRecord(cursor)) {
+        if (++cursor->block >= cursor->table->blockCount) {
+            cursor->valid = 0;
+            return;
         }
+        cursor->offset = 0;
     }
+    cursor->valid = 1;
 }
 
-graphNode* findCommonAncestor(graphNode* commit1, graphNode* commit2) {
-    graphNode* ancestor1 = commit1;
-    while (ancestor1 != NULL) {
-        graphNode* ancestor2 = commit2;
-        while (ancestor2 != NULL) {
-            if (ancestor1 == ancestor2) {
-                return ancestor1;
-            }
-            ancestor2 = ancestor2->parent;
+// Positions the cursor on the first record whose name is >= name: a binary search over
+// block first names, then over the block's restart points, then a short linear scan
+void seekRefTable(const refTable* table, const char* name, refCursor* cursor) {
+    cursor->table = table;
+    cursor->valid = 0;
+    cursor->block = 0;
+    cursor->offset = 0;
+    if (table->blockCount == 0) {
+        return;
+    }
+    unsigned int low = 0;
+    unsigned int high = table->blockCount;
+    while (high - low > 1) {
+        unsigned int middle = (low + high) / 2;
+        if (compareBlockKey(table, middle, name) <= 0) {
+            low = middle;
+        } else {
+            high = middle;
         }
-        ancestor1 = ancestor1->parent;
     }
+    cursor->block = low;
 
-    return NULL;
+    const unsigned char* block = refBlock(table, low);
+    int restartCount = refRestartCount(table, low);
+    const unsigned char* restarts = block + table->blockSize - restartCount * 4 - 2;
+    int left = 0;
+    int right = restartCount;
+    while (right - left > 1) {
+        int middle = (left + right) / 2;
+        cursor->offset = readU32(restarts + middle * 4);
+        if (readRefRecord(cursor) && strcmp(cursor->name, name) <= 0) {
+            left = middle;
+        } else {
+            right = middle;
+        }
+    }
+    cursor->offset = readU32(restarts + left * 4);
+    advanceRefCursor(cursor);
+    while (cursor->valid && strcmp(cursor->name, name) < 0) {
+        advanceRefCursor(cursor);
+    }
 }
 
-char* getFileContent(int fileID, repository* repo) {
-    int hashIndex = fileID % N;
-    File* currentFile = repo->fileHash[hashIndex];
-    while (currentFile != NULL) {
-        if (currentFile->fileID == fileID) {
-            return currentFile->content;
+void listPackedRefs(const char* prefix) {
+    refTable table;
+    if (!openRefTable(PACKED_REFS, &table)) {
+        printf("No packed refs.\n");
+        return;
+    }
+    refCursor cursor;
+    size_t length = strlen(prefix);
+    int shown = 0;
+    for (seekRefTable(&table, prefix, &cursor); cursor.valid && strncmp(cursor.name, prefix, length) == 0;
+         advanceRefCursor(&cursor)) {
+        if (cursor.type == REF_ANNOTATED_TAG) {
+            printf("%s -> tag object %d -> %d\n", cursor.name, cursor.target, cursor.peeled);
+        } else {
+            printf("%s -> %d\n", cursor.name, cursor.target);
         }
-        currentFile = currentFile->next;
+        shown++;
     }
-    return "File not found";
+    printf("%d of %u packed ref(s) shown.\n", shown, table.refCount);
+    closeRefTable(&table);
 }
 
-void applyChanges(repository* repo, graphNode* commit, graphNode* commonAncestor) {
-    while (commit != commonAncestor) {
-        for (int i = 0; i < commit->commit->fileCount; i++) {
-            int fileID = commit->commit->fileIDs[i];
-            char* content = getFileContent(fileID, repo);
-            char* ancestorContent = getFileContent(fileID, repo);
+//-----------------TAGS-------------------------------------------------
 
-            if (strcmp(content, ancestorContent) != 0) {
-                printf("Conflict detected in file %d. Manual resolution required.\n", fileID);
-            } else {
-                printf("File %d merged successfully.\n", fileID);
-            }
+// Tags live in the ref store as "tags/<name>". A lightweight tag is just a ref to the
+// commit; an annotated tag also stores a tag object (a regular stored file) and keeps
+// the commit it points to as the ref's target, so peeling never reads the object.
+int createTag(repository* repo, const char* tagName, graphNode* target, const char* message, const char* tagger) {
+    char refName[MAX_BRANCH_NAME_LENGTH];
+    if (snprintf(refName, sizeof(refName), "%s%s", TAG_PREFIX, tagName) >= (int)sizeof(refName)) {
+        printf("Error: Tag name too long.\n");
+        return 0;
+    }
+    if (findBranch(repo, refName) != -1) {
+        printf("Error: Tag '%s' already exists.\n", tagName);
+        return 0;
+    }
+
+    int object = -1;
+    if (message != NULL && message[0] != '\0') {
+        textBuffer content = {NULL, 0, 0};
+        appendText(&content, "object %d\ntag %s\ntagger %s %ld\n\n%s\n", target->commit->fileID, tagName, tagger,
+                   (long)time(NULL), message);
+        File* tagObject = storeFile(repo, content.data, content.size);
+        free(content.data);
+        if (tagObject == NULL) {
+            return 0;
         }
+        object = tagObject->fileID;
+    }
 
-        commit = commit->parent;
+    refTransaction transaction;
+    initRefTransaction(&transaction, object >= 0 ? "tag: annotated" : "tag");
+    addRefUpdate(&transaction, refName, NULL, target);
+    transaction.updates[0].object = object;
+    int created = commitRefTransaction(repo, &transaction) == REF_TX_OK;
+    freeRefTransaction(&transaction);
+    if (created) {
+        printf("Tag '%s' created at commit %d.\n", tagName, target->commit->fileID);
     }
+    return created;
 }
 
-void merge(repository* repo, graphNode* commit1, graphNode* commit2) {
-    graphNode* commonAncestor = findCommonAncestor(commit1, commit2);
+// Resolves a tag to its commit ID from the ref store, which keeps the peeled commit as
+// the ref's target; a tag missing from the store does not exist, whatever a packed
+// table once said
+int resolveTag(repository* repo, const char* tagName, int* commitID, int* object) {
+    char refName[MAX_BRANCH_NAME_LENGTH];
+    snprintf(refName, sizeof(refName), "%s%s", TAG_PREFIX, tagName);
+    int refIndex = findBranch(repo, refName);
+    if (refIndex == -1 || repo->nodes[refIndex] == NULL) {
+        return 0;
+    }
+    *commitID = repo->nodes[refIndex]->commit->fileID;
+    *object = repo->refObjects[refIndex];
+    return 1;
+}
 
-    if (commonAncestor == NULL) {
-        printf("No common ancestor found. Merge aborted.\n");
+void showTag(repository* repo, const char* tagName) {
+    int commitID;
+    int object;
+    if (!resolveTag(repo, tagName, &commitID, &object)) {
+        printf("Error: Tag '%s' not found.\n", tagName);
         return;
     }
-
-    applyChanges(repo, commit1, commonAncestor);
-    applyChanges(repo, commit2, commonAncestor);
-
-    printf("Merge successful.\n");
+    printf("Tag %s -> commit %d\n", tagName, commitID);
+    File* tagObject = object >= 0 ? findFile(object, repo) : NULL;
+    if (tagObject != NULL) {
+        printf("%s", tagObject->content);
+    }
 }
 
-repository* copyRepository(repository* originalRepo) {
-    char repoName[100];
-    printf("Enter repository name: ");
-    scanf("%s", repoName);
-    repository* newRepo = initRepository(repoName);
-
-    for (int i = 0; i < N; i++) {
-        graphNode* current = originalRepo->nodes[i];
-        while (current != NULL) {
-            commit* newCommit = (commit*)malloc(sizeof(commit));
-            memcpy(newCommit, current->commit, sizeof(commit));
-
-            graphNode* newNode = createGraphNode(newCommit);
-
-            int index = current->commit->fileID % N;
-            if (newRepo->nodes[index] == NULL) {
-                newRepo->nodes[index] = newNode;
-            } else {
-                newNode->nextParent = newRepo->nodes[index];
-                newRepo->nodes[index] = newNode;
-            }
-
-            current = current->nextParent;
-        }
+// Records how the user resolved the conflicts of the last merge, taken from the
+// working directory, so later merges hitting the same conflicts resolve them
+void recordResolutions(repository* repo) {
+    if (repo->worktree->pendingResolutions == NULL || repo->worktree->pendingResolutions->count == 0) {
+        printf("No conflicted merge to record resolutions from.\n");
+        return;
     }
-
-    for (int i = 0; i < N; i++) {
-        File* currentFile = originalRepo->fileHash[i];
-        while (currentFile != NULL) {
-            File* newFile = (File*)malloc(sizeof(File));
-            memcpy(newFile, currentFile, sizeof(File));
-
-            int index = currentFile->fileID % N;
-            if (newRepo->fileHash[index] == NULL) {
-                newRepo->fileHash[index] = newFile;
-            } else {
-                newFile->next = newRepo->fileHash[index];
-                newRepo->fileHash[index] = newFile;
-            }
-
-            currentFile = currentFile->next;
+    int recorded = 0;
+    for (int i = 0; i < repo->worktree->pendingResolutions->count; i++) {
+        treeEntry* entry = &repo->worktree->pendingResolutions->entries[i];
+        File* conflicted = findFile(entry->fileID, repo);
+        size_t resolvedSize;
+        char location[WORKING_PATH_LENGTH];
+        char* resolved = readWholeFile(workingPath(repo, entry->path, location), &resolvedSize);
+        if (conflicted == NULL || resolved == NULL) {
+            printf("Skipping %s: file not found.\n", entry->path);
+        } else if (findText(resolved, resolvedSize, "<<<<<<< ", 8) != NULL) {
+            printf("Skipping %s: conflict markers are still present.\n", entry->path);
+        } else {
+            int count = recordFileResolutions(conflicted->content, conflicted->size, resolved, resolvedSize);
+            printf("Recorded %d resolution(s) for %s.\n", count, entry->path);
+            recorded += count;
         }
+        free(resolved);
+    }
+    if (recorded > 0) {
+        freeSnapshot(repo->worktree->pendingResolutions);
+        repo->worktree->pendingResolutions = NULL;
     }
-
-    return newRepo;
 }
 
 commitStack* initCommitStack() {
@@ -561,6 +5847,9 @@ void displayCommitHistory(commitStack* stack) {
     }
 }
 
+// Drops the most recent commit by moving every branch at it back to its parent, in one
+// ref transaction so the reflog records the move. The node itself is kept: the commit
+// index, caches and reflog may still refer to it.
 void deleteMostRecentCommit(repository* repo, commitStack* stack) {
     if (isEmpty(stack)) {
         printf("Error: Commit history is empty.\n");
@@ -568,33 +5857,88 @@ void deleteMostRecentCommit(repository* repo, commitStack* stack) {
     }
 
     graphNode* recentCommit = pop(stack);
-    graphNode* recentNode = NULL;
-    for (int i = 0; i < N; i++) {
-        graphNode* current = repo->nodes[i];
-        graphNode* prev = NULL;
-        while (current != NULL) {
-            if (current == recentCommit) {
-                if (prev != NULL) {
-                    prev->nextParent = current->nextParent;
-                } else {
-                    repo->nodes[i] = current->nextParent;
-                }
-                free(current->commit);
-                free(current);
-                return;
-            }
-            prev = current;
-            current = current->nextParent;
+    if (recentCommit->parent == NULL) {
+        printf("Error: Cannot delete the initial commit.\n");
+        push(recentCommit, stack);
+        return;
+    }
+    char reason[REFLOG_MESSAGE_LENGTH];
+    snprintf(reason, sizeof(reason), "reset: drop commit %d", recentCommit->commit->fileID);
+    refTransaction transaction;
+    initRefTransaction(&transaction, reason);
+    for (int i = 0; i < repo->branchCount; i++) {
+        if (repo->nodes[i] == recentCommit && !isTagRef(repo->branches[i])) {
+            addRefUpdate(&transaction, repo->branches[i], recentCommit, recentCommit->parent);
         }
     }
+    if (transaction.count == 0) {
+        printf("Error: Commit %d is not a branch tip.\n", recentCommit->commit->fileID);
+        push(recentCommit, stack);
+    } else if (commitRefTransaction(repo, &transaction) == REF_TX_OK) {
+        printf("Deleted commit %d from %d branch(es).\n", recentCommit->commit->fileID, transaction.count);
+    } else {
+        push(recentCommit, stack);
+    }
+    freeRefTransaction(&transaction);
 }
 
-graphNode* undoMove(commitStack* stack) {
-    if (isEmpty(stack)) {
-        printf("Error: Commit history is empty.\n");
+// Moves the current branch back to where the latest move not yet undone came from, so
+// repeated undos keep stepping back instead of undoing each other. Each undo entry
+// cancels the newest earlier move. Local modifications the move would overwrite abort it.
+graphNode* undoMove(repository* repo) {
+    const char* name = repo->branches[repo->worktree->currentBranchIndex];
+    graphNode* current = repo->nodes[repo->worktree->currentBranchIndex];
+    long count = 0;
+    FILE* file = openReflog(name, &count);
+    reflogRecord record;
+    int found = 0;
+    long undone = 0; // Moves already reverted by the undo entries passed so far
+    for (long index = count - 1; file != NULL && index >= 0 && !found; index--) {
+        if (!readReflogRecord(file, index, &record)) {
+            break;
+        }
+        if (strncmp(record.message, UNDO_REFLOG_PREFIX, strlen(UNDO_REFLOG_PREFIX)) == 0) {
+            undone++;
+        } else if (undone > 0) {
+            undone--;
+        } else {
+            found = 1;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (!found || record.oldID == REFLOG_NO_COMMIT) {
+        printf("Error: No earlier position of '%s' in the reflog.\n", name);
+        return NULL;
+    }
+    if (current == NULL || record.newID != current->commit->fileID) {
+        printf("Error: The reflog of '%s' does not end at its current tip.\n", name);
         return NULL;
     }
-    return stack->top->next->node;
+    graphNode* previous = findCommit(repo, record.oldID);
+    if (previous == NULL) {
+        printf("Error: Commit %d not found.\n", record.oldID);
+        return NULL;
+    }
+    char reason[REFLOG_MESSAGE_LENGTH];
+    snprintf(reason, sizeof(reason), UNDO_REFLOG_PREFIX "back to %d", record.oldID);
+    if (!updateWorkingTree(repo, getSnapshot(current), getSnapshot(previous))) {
+        printf("Undo aborted.\n");
+        return NULL;
+    }
+    if (updateBranch(repo, name, current, previous, reason) != REF_TX_OK) {
+        updateWorkingTree(repo, getSnapshot(previous), getSnapshot(current)); // Put back the files just written
+        return NULL;
+    }
+    return previous;
+}
+
+void expireReflogVisitor(repository* repo, int refIndex, void* context) {
+    long removed = expireReflog(repo->branches[refIndex], *(time_t*)context);
+    if (removed > 0) {
+        printf("Expired %ld reflog entr%s of '%s'.\n", removed, removed == 1 ? "y" : "ies", repo->branches[refIndex]);
+    }
 }
 
 void pushCommitsUsingBFS(graphNode* startNode, commitStack* stack) {
@@ -626,14 +5970,7 @@ void pushCommitsUsingBFS(graphNode* startNode, commitStack* stack) {
 void printBranchContent(repository* repo, const char* branchName) {
     printf("Content of branch '%s':\n", branchName);
 
-    int branchIndex = -1;
-    for (int i = 0; i < repo->branchCount; i++) {
-        if (strcmp(repo->branches[i], branchName) == 0) {
-            branchIndex = i;
-            break;
-        }
-    }
-
+    int branchIndex = findBranch(repo, branchName);
     if (branchIndex == -1) {
         printf("Error: Branch '%s' not found.\n", branchName);
         return;
@@ -643,12 +5980,16 @@ void printBranchContent(repository* repo, const char* branchName) {
     while (headCommit != NULL) {
         for (int i = 0; i < headCommit->commit->fileCount; i++) {
             int fileID = headCommit->commit->fileIDs[i];
-            char* content = getFileContent(fileID, repo);
+            File* file = findFile(fileID, repo);
             printf("File ID: %d\n", fileID);
-            printf("Content:\n%s\n", content);
+            if (file != NULL) {
+                printFileContent(file);
+            } else {
+                printf("Content:\nFile not found\n");
+            }
             printf("------------------------\n");
         }
-        headCommit = headCommit->nextParent;
+        headCommit = headCommit->parent;
     }
 }
 
@@ -681,6 +6022,31 @@ int main() {
         printf("9. Undo move\n");
         printf("10. Push commits using BFS\n");
         printf("11. Display commit history\n");
+        printf("12. Diff commits\n");
+        printf("13. Create binary delta\n");
+        printf("14. Apply binary delta\n");
+        printf("15. Dry-run merge (in memory)\n");
+        printf("16. Record conflict resolutions\n");
+        printf("17. Cherry-pick commits\n");
+        printf("18. Revert commits\n");
+        printf("19. Rebase current branch\n");
+        printf("20. List branches\n");
+        printf("21. Pack refs\n");
+        printf("22. Look up packed refs\n");
+        printf("23. Update branches atomically\n");
+        printf("24. Show reflog\n");
+        printf("25. Find branch position at a past time\n");
+        printf("26. Expire reflogs\n");
+        printf("27. Create tag\n");
+        printf("28. Show tag\n");
+        printf("29. Show branches ahead/behind\n");
+        printf("30. Set sparse checkout directories\n");
+        printf("31. Show working directory status\n");
+        printf("32. Add worktree\n");
+        printf("33. Switch worktree\n");
+        printf("34. List worktrees\n");
+        printf("35. Remove worktree\n");
+        printf("36. Abort merge\n");
         printf("0. Exit\n");
         printf("Enter your choice: ");
         scanf("%d", &choice);
@@ -748,8 +6114,8 @@ int main() {
                 int commitID2;
                 scanf("%d", &commitID2);
 
-                graphNode* commit1 = myRepo->nodes[commitID1 % N];
-                graphNode* commit2 = myRepo->nodes[commitID2 % N];
+                graphNode* commit1 = findCommit(myRepo, commitID1);
+                graphNode* commit2 = findCommit(myRepo, commitID2);
                 merge(myRepo, commit1, commit2);
                 break;
 
@@ -762,7 +6128,7 @@ int main() {
                 break;
 
             case 9:
-                nextCommit = undoMove(stack);
+                nextCommit = undoMove(myRepo);
                 if (nextCommit != NULL) {
                     printf("Next commit after undo move:\n");
                     displayCommitInfo(nextCommit);
@@ -773,7 +6139,7 @@ int main() {
                 printf("Enter commit ID: ");
                 int bfsCommitID;
                 scanf("%d", &bfsCommitID);
-                graphNode* bfsCommit = myRepo->nodes[bfsCommitID % N];
+                graphNode* bfsCommit = findCommit(myRepo, bfsCommitID);
                 pushCommitsUsingBFS(bfsCommit, stack2);
                 break;
 
@@ -784,6 +6150,306 @@ int main() {
                 displayCommitHistory(stack2);
                 break;
 
+            case 12:
+                printf("Enter old commit ID: ");
+                int oldCommitID;
+                scanf("%d", &oldCommitID);
+                printf("Enter new commit ID: ");
+                int newCommitID;
+                scanf("%d", &newCommitID);
+
+                graphNode* oldCommit = findCommit(myRepo, oldCommitID);
+                graphNode* newCommit = findCommit(myRepo, newCommitID);
+                if (oldCommit == NULL || newCommit == NULL) {
+                    printf("Error: Commit not found.\n");
+                    break;
+                }
+                printf("Enter output mode (--name-status, --stat, --numstat, --patch): ");
+                char diffMode[20];
+                scanf("%19s", diffMode);
+
+                diffList* commitDiff = diffCommits(myRepo, oldCommit, newCommit);
+                if (strcmp(diffMode, "--stat") == 0 || strcmp(diffMode, "--numstat") == 0) {
+                    printDiffStat(myRepo, commitDiff, strcmp(diffMode, "--numstat") == 0);
+                } else if (strcmp(diffMode, "--patch") == 0) {
+                    printDiffPatch(myRepo, commitDiff);
+                } else {
+                    printDiff(commitDiff);
+                }
+                freeDiffList(commitDiff);
+                break;
+
+            case 13:
+            case 14: {
+                char sourceName[50];
+                char inputName[50];
+                char outputName[50];
+                printf("Enter source file name: ");
+                scanf("%s", sourceName);
+                printf(choice == 13 ? "Enter target file name: " : "Enter delta file name: ");
+                scanf("%s", inputName);
+                printf("Enter output file name: ");
+                scanf("%s", outputName);
+
+                size_t sourceSize;
+                size_t inputSize;
+                char* sourceData = readWholeFile(sourceName, &sourceSize);
+                char* inputData = readWholeFile(inputName, &inputSize);
+                if (sourceData == NULL || inputData == NULL) {
+                    printf("Error: Unable to open file.\n");
+                } else if (choice == 13) {
+                    deltaBuffer* delta = createDelta(sourceData, sourceSize, inputData, inputSize);
+                    if (writeWholeFile(outputName, (const char*)delta->data, delta->size)) {
+                        printf("Delta written: %zu bytes (%d copy, %d insert ops)\n", delta->size, delta->copyOps, delta->insertOps);
+                    } else {
+                        printf("Error: Unable to write file.\n");
+                    }
+                    freeDelta(delta);
+                } else {
+                    size_t targetSize;
+                    char* target = applyDelta(sourceData, sourceSize, (const unsigned char*)inputData, inputSize, &targetSize);
+                    if (target == NULL) {
+                        printf("Error: Delta does not apply to %s.\n", sourceName);
+                    } else if (writeWholeFile(outputName, target, targetSize)) {
+                        printf("Patched file written: %zu bytes\n", targetSize);
+                    } else {
+                        printf("Error: Unable to write file.\n");
+                    }
+                    free(target);
+                }
+                free(sourceData);
+                free(inputData);
+                break;
+            }
+
+            case 15: {
+                printf("Enter commit 1 ID: ");
+                int ourCommitID;
+                scanf("%d", &ourCommitID);
+                printf("Enter commit 2 ID: ");
+                int theirCommitID;
+                scanf("%d", &theirCommitID);
+
+                mergeReport report;
+                initMergeReport(&report);
+                int candidateID = mergeInMemory(myRepo, ourCommitID, theirCommitID, &report);
+                if (candidateID != -1) {
+                    printf("Mergeable. Candidate merge commit: %d\n", candidateID);
+                } else if (report.conflicts > 0) {
+                    printMergeReport(&report);
+                    printf("Not mergeable: %d conflicted file(s).\n", report.conflicts);
+                } else {
+                    printf("Not mergeable: commits not found or no common ancestor.\n");
+                }
+                freeMergeReport(&report);
+                break;
+            }
+
+            case 16:
+                recordResolutions(myRepo);
+                break;
+
+            case 17:
+            case 18: {
+                printf("Enter number of commits: ");
+                int pickCount;
+                scanf("%d", &pickCount);
+                if (pickCount <= 0) {
+                    printf("Error: Invalid number of commits.\n");
+                    break;
+                }
+                int* pickIDs = (int*)malloc(pickCount * sizeof(int));
+                printf("Enter commit IDs in order: ");
+                for (int i = 0; i < pickCount; i++) {
+                    scanf("%d", &pickIDs[i]);
+                }
+                pickCommits(myRepo, pickIDs, pickCount, choice == 18);
+                free(pickIDs);
+                break;
+            }
+
+            case 19: {
+                printf("Enter upstream commit ID: ");
+                int upstreamID;
+                scanf("%d", &upstreamID);
+                graphNode* upstream = findCommit(myRepo, upstreamID);
+                if (upstream == NULL) {
+                    printf("Error: Commit %d not found.\n", upstreamID);
+                    break;
+                }
+                rebase(myRepo, upstream);
+                break;
+            }
+
+            case 20:
+                printf("Enter branch name prefix (or * for all): ");
+                scanf("%99s", branch);
+                forEachRef(myRepo, strcmp(branch, "*") == 0 ? "" : branch, printBranchTip, NULL);
+                break;
+
+            case 21:
+                packRefs(myRepo);
+                break;
+
+            case 22:
+                printf("Enter ref name prefix (or * for all): ");
+                scanf("%99s", branch);
+                listPackedRefs(strcmp(branch, "*") == 0 ? "" : branch);
+                break;
+
+            case 23: {
+                printf("Enter number of branch updates: ");
+                int updateCount;
+                scanf("%d", &updateCount);
+                refTransaction transaction;
+                initRefTransaction(&transaction, "update-ref");
+                int valid = updateCount > 0;
+                for (int i = 0; i < updateCount && valid; i++) {
+                    char oldValue[20];
+                    char newValue[20];
+                    printf("Enter branch, expected old commit ID (or none) and new commit ID (or delete): ");
+                    scanf("%99s %19s %19s", branch, oldValue, newValue);
+                    graphNode* expectedOld = strcmp(oldValue, "none") == 0 ? NULL : findCommit(myRepo, atoi(oldValue));
+                    graphNode* newTip = strcmp(newValue, "delete") == 0 ? NULL : findCommit(myRepo, atoi(newValue));
+                    if ((expectedOld == NULL && strcmp(oldValue, "none") != 0) ||
+                        (newTip == NULL && strcmp(newValue, "delete") != 0)) {
+                        printf("Error: Commit not found.\n");
+                        valid = 0;
+                    }
+                    addRefUpdate(&transaction, branch, expectedOld, newTip);
+                }
+                if (valid && commitRefTransaction(myRepo, &transaction) == REF_TX_OK) {
+                    printf("Updated %d branch(es).\n", updateCount);
+                }
+                freeRefTransaction(&transaction);
+                break;
+            }
+
+            case 24: {
+                printf("Enter branch name: ");
+                scanf("%99s", branch);
+                printf("Enter number of entries: ");
+                long limit;
+                scanf("%ld", &limit);
+                printReflog(branch, limit);
+                break;
+            }
+
+            case 25: {
+                printf("Enter branch name: ");
+                scanf("%99s", branch);
+                printf("Enter minutes ago: ");
+                long minutes;
+                scanf("%ld", &minutes);
+                reflogRecord record;
+                if (readReflogAt(branch, time(NULL) - minutes * 60, &record)) {
+                    char label[REF_PATH_LENGTH];
+                    snprintf(label, sizeof(label), "%s@{%ld minutes ago}", branch, minutes);
+                    printReflogRecord(label, &record);
+                } else {
+                    printf("No reflog entry for '%s' that old.\n", branch);
+                }
+                break;
+            }
+
+            case 26: {
+                printf("Expire entries older than how many days (default %d)? ", REFLOG_EXPIRE_DAYS);
+                long days;
+                if (scanf("%ld", &days) != 1 || days < 0) {
+                    days = REFLOG_EXPIRE_DAYS;
+                }
+                time_t cutoff = time(NULL) - days * 24 * 60 * 60;
+                forEachRef(myRepo, "", expireReflogVisitor, &cutoff);
+                break;
+            }
+
+            case 27: {
+                printf("Enter tag name: ");
+                scanf("%99s", branch);
+                printf("Enter commit ID: ");
+                int tagCommitID;
+                scanf("%d", &tagCommitID);
+                graphNode* tagTarget = findCommit(myRepo, tagCommitID);
+                if (tagTarget == NULL) {
+                    printf("Error: Commit %d not found.\n", tagCommitID);
+                    break;
+                }
+                printf("Enter tag message (or - for a lightweight tag): ");
+                scanf(" %99[^\n]", message);
+                printf("Enter tagger: ");
+                scanf("%49s", author);
+                createTag(myRepo, branch, tagTarget, strcmp(message, "-") == 0 ? NULL : message, author);
+                break;
+            }
+
+            case 28:
+                printf("Enter tag name: ");
+                scanf("%99s", branch);
+                showTag(myRepo, branch);
+                break;
+
+            case 29:
+                printf("Enter base branch: ");
+                scanf("%99s", branch);
+                printAheadBehind(myRepo, branch);
+                break;
+
+            case 30: {
+                printf("Enter number of directories (0 to check out everything): ");
+                int directoryCount;
+                scanf("%d", &directoryCount);
+                if (directoryCount < 0) {
+                    printf("Invalid number of directories.\n");
+                    break;
+                }
+                char** directories = (char**)malloc((directoryCount + 1) * sizeof(char*));
+                for (int i = 0; i < directoryCount; i++) {
+                    char directory[50];
+                    printf("Enter directory: ");
+                    scanf("%49s", directory);
+                    directories[i] = strdup(directory);
+                }
+                setSparseCheckout(myRepo, directories, directoryCount);
+                for (int i = 0; i < directoryCount; i++) {
+                    free(directories[i]);
+                }
+                free(directories);
+                break;
+            }
+
+            case 31:
+                printStatus(myRepo);
+                break;
+
+            case 32: {
+                char worktreeName[MAX_BRANCH_NAME_LENGTH];
+                char worktreePath[REF_PATH_LENGTH];
+                printf("Enter worktree name, directory and branch: ");
+                scanf("%99s %131s %99s", worktreeName, worktreePath, branch);
+                addWorktree(myRepo, worktreeName, worktreePath, branch);
+                break;
+            }
+
+            case 33:
+                printf("Enter worktree name (main for the main worktree): ");
+                scanf("%99s", branch);
+                switchWorktree(myRepo, branch);
+                break;
+
+            case 34:
+                listWorktrees(myRepo);
+                break;
+
+            case 35:
+                printf("Enter worktree name: ");
+                scanf("%99s", branch);
+                removeWorktree(myRepo, branch);
+                break;
+
+            case 36:
+                abortMerge(myRepo);
+                break;
+
             case 0:
                 printf("Exiting program.\n");
                 break;